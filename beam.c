@@ -0,0 +1,286 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "chip8.h"
+#include "stateset.h"
+
+/*
+ * Beam search over key inputs. Every step, each state in the beam is
+ * forked once per candidate key mask and run for a few frames holding it.
+ * Children that land on an already visited state are dropped, the rest are
+ * scored and the best ones form the next beam. Forks share memory pages
+ * copy-on-write, so a child costs a few hundred bytes until it writes.
+ */
+
+struct Node
+{
+    struct Chip8State *c8;
+    long score;
+    uint32_t order;             /* parent * nchoices + choice, breaks ties */
+    uint16_t *path;             /* key mask held during each step so far */
+};
+
+struct Search
+{
+    /* parameters */
+    int width;
+    int depth;
+    int frames;
+    int threads;
+    int score_addr;             /* score by this memory byte, if >= 0 */
+    int score_reg;              /* score by this register, if >= 0 */
+    uint16_t choices[17];
+    int nchoices;
+
+    /* per step */
+    int step;
+    struct Node *beam;
+    int nbeam;
+    struct Node *cands;
+    int ncands;
+    struct StateSet *visited;
+    atomic_long dropped;
+};
+
+struct Worker
+{
+    struct Search *s;
+    int id;
+};
+
+static long score_state(const struct Search *s, const struct Chip8State *c8)
+{
+    if (s->score_addr >= 0) {
+        return chip8_mem_read(c8, s->score_addr);
+    }
+    if (s->score_reg >= 0) {
+        return c8->reg[s->score_reg];
+    }
+    /* default: fewer lit pixels is better, e.g. more cleared lines */
+    long lit = 0;
+    for (int y = 0; y < CHIP8_HEIGHT; y++) {
+        lit += __builtin_popcountll(c8->screen[y]);
+    }
+    return -lit;
+}
+
+static void *expand(void *arg)
+{
+    struct Worker *w = arg;
+    struct Search *s = w->s;
+
+    for (int i = w->id; i < s->ncands; i += s->threads) {
+        const struct Node *parent = &s->beam[i / s->nchoices];
+        struct Node *child = &s->cands[i];
+        uint16_t keys = s->choices[i % s->nchoices];
+
+        child->c8 = chip8state_fork(parent->c8);
+        child->c8->keys = keys;
+        for (int f = 0; f < s->frames; f++) {
+            chip8state_run_frame(child->c8);
+        }
+        if (stateset_insert(s->visited, chip8state_hash(child->c8)) != 1) {
+            chip8state_destroy(child->c8);
+            child->c8 = NULL;
+            atomic_fetch_add(&s->dropped, 1);
+            continue;
+        }
+        child->score = score_state(s, child->c8);
+        child->order = i;
+        child->path = malloc(s->depth * sizeof(uint16_t));
+        memcpy(child->path, parent->path, s->step * sizeof(uint16_t));
+        child->path[s->step] = keys;
+    }
+    return NULL;
+}
+
+/* Best score first; pruned (NULL) nodes last */
+static int node_cmp(const void *a, const void *b)
+{
+    const struct Node *x = a, *y = b;
+    if (x->c8 == NULL || y->c8 == NULL) {
+        return (x->c8 == NULL) - (y->c8 == NULL);
+    }
+    if (x->score != y->score) {
+        return x->score < y->score ? 1 : -1;
+    }
+    return x->order < y->order ? -1 : x->order > y->order;
+}
+
+static void free_node(struct Node *n)
+{
+    if (n->c8 != NULL) {
+        chip8state_destroy(n->c8);
+        free(n->path);
+        n->c8 = NULL;
+    }
+}
+
+static int parse_keys(struct Search *s, const char *keys)
+{
+    s->nchoices = 0;
+    s->choices[s->nchoices++] = 0;
+    for (const char *k = keys; *k; k++) {
+        char digit[2] = {*k, 0};
+        char *end;
+        long key = strtol(digit, &end, 16);
+        if (*end != 0) {
+            fprintf(stderr, "Bad key: %c\n", *k);
+            return 1;
+        }
+        s->choices[s->nchoices++] = 1 << key;
+        if (s->nchoices == 17) {
+            break;
+        }
+    }
+    return 0;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-w width] [-d depth] [-f frames] [-k keys] [-j threads]\n"
+            "       [-s addr | -v reg] ROM [clock_speed]\n"
+            "  -w width   states kept per step (default 64)\n"
+            "  -d depth   steps to search (default 100)\n"
+            "  -f frames  frames each input is held for (default 6)\n"
+            "  -k keys    hex keys to try besides none (default 456)\n"
+            "  -j threads worker threads (default: online CPUs)\n"
+            "  -s addr    maximize the byte at this hex memory address\n"
+            "  -v reg     maximize this register (hex index)\n"
+            "             default: minimize lit pixels\n",
+            prog);
+}
+
+int main(int argc, char *argv[])
+{
+    struct Search s;
+    memset(&s, 0, sizeof(s));
+    s.width = 64;
+    s.depth = 100;
+    s.frames = 6;
+    s.threads = sysconf(_SC_NPROCESSORS_ONLN);
+    s.score_addr = -1;
+    s.score_reg = -1;
+    parse_keys(&s, "456");
+
+    int opt;
+    while ((opt = getopt(argc, argv, "w:d:f:k:j:s:v:")) != -1) {
+        switch (opt) {
+        case 'w':
+            s.width = atoi(optarg);
+            break;
+        case 'd':
+            s.depth = atoi(optarg);
+            break;
+        case 'f':
+            s.frames = atoi(optarg);
+            break;
+        case 'k':
+            if (parse_keys(&s, optarg) != 0) {
+                return 1;
+            }
+            break;
+        case 'j':
+            s.threads = atoi(optarg);
+            break;
+        case 's':
+            s.score_addr = strtol(optarg, NULL, 16) & CHIP8_ADDR_MASK;
+            break;
+        case 'v':
+            s.score_reg = strtol(optarg, NULL, 16) & 0xF;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind >= argc) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (s.width < 1 || s.depth < 1 || s.threads < 1) {
+        fprintf(stderr, "width, depth and threads must be positive\n");
+        return 1;
+    }
+
+    struct Chip8State *root = NULL;
+    if (chip8state_init(&root, argv[optind]) != 0) {
+        return 1;
+    }
+    if (argc > optind + 1) {
+        root->clock_speed = chip8_parse_clock_speed(argv[optind + 1]);
+        if (root->clock_speed == 0) {
+            return 1;
+        }
+    }
+
+    s.beam = calloc(s.width * s.nchoices, sizeof(struct Node));
+    s.cands = calloc(s.width * s.nchoices, sizeof(struct Node));
+    s.visited = stateset_create((size_t)s.width * s.nchoices * s.depth);
+    atomic_init(&s.dropped, 0);
+    s.beam[0].c8 = root;
+    s.beam[0].score = score_state(&s, root);
+    s.beam[0].path = calloc(s.depth, sizeof(uint16_t));
+    s.nbeam = 1;
+
+    pthread_t *tids = malloc(s.threads * sizeof(pthread_t));
+    struct Worker *workers = malloc(s.threads * sizeof(struct Worker));
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    long expanded = 0;
+
+    for (s.step = 0; s.step < s.depth && s.nbeam > 0; s.step++) {
+        s.ncands = s.nbeam * s.nchoices;
+        for (int t = 0; t < s.threads; t++) {
+            workers[t].s = &s;
+            workers[t].id = t;
+            pthread_create(&tids[t], NULL, expand, &workers[t]);
+        }
+        for (int t = 0; t < s.threads; t++) {
+            pthread_join(tids[t], NULL);
+        }
+        expanded += s.ncands;
+
+        qsort(s.cands, s.ncands, sizeof(struct Node), node_cmp);
+        for (int i = 0; i < s.nbeam; i++) {
+            free_node(&s.beam[i]);
+        }
+        s.nbeam = 0;
+        for (int i = 0; i < s.ncands; i++) {
+            if (s.cands[i].c8 != NULL && s.nbeam < s.width) {
+                s.beam[s.nbeam++] = s.cands[i];
+                s.cands[i].c8 = NULL;
+            } else {
+                free_node(&s.cands[i]);
+            }
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    fprintf(stderr, "%ld states expanded, %ld duplicates dropped, %.3f s (%.0f states/s)\n",
+            expanded, (long)atomic_load(&s.dropped), secs, expanded / secs);
+
+    if (s.nbeam == 0) {
+        fprintf(stderr, "Every branch reached a visited state\n");
+        return 1;
+    }
+    printf("score %ld\n", s.beam[0].score);
+    for (int i = 0; i < s.step; i++) {
+        printf("%04X%c", s.beam[0].path[i], (i + 1) % 16 == 0 ? '\n' : ' ');
+    }
+    printf("\n");
+
+    for (int i = 0; i < s.nbeam; i++) {
+        free_node(&s.beam[i]);
+    }
+    stateset_destroy(s.visited);
+    free(s.beam);
+    free(s.cands);
+    free(tids);
+    free(workers);
+    return 0;
+}
@@ -1,14 +1,24 @@
 #include <stdio.h>
 #include <string.h>
+#ifdef CHIP8_GUARD_PAGES
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 #include "chip8.h"
 #ifdef DEBUG
 #include "debug.h"
 #endif
 
 
-uint8_t random_byte(void)
+/* xorshift32, kept in the state so snapshots replay the same numbers */
+uint8_t random_byte(struct Chip8State *c8)
 {
-    return (uint8_t)(rand() % 256);
+    uint32_t x = c8->rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    c8->rng = x;
+    return (uint8_t)(x >> 24);
 }
 
 /* Builtin font sprites */
@@ -31,29 +41,278 @@ const uint8_t sprite_data[16][5] = {
     {0xF0, 0x80, 0xF0, 0x80, 0x80,}, /* F */
 };
 
+/*
+ * Pages are allocated one at a time so forks can share them. Building with
+ * -DCHIP8_GUARD_PAGES maps each page between PROT_NONE pages, so an access
+ * that escapes the address masking faults instead of corrupting the heap.
+ */
+#ifdef CHIP8_GUARD_PAGES
+static size_t guard_span(size_t size, size_t page)
+{
+    return (size + page - 1) / page * page;
+}
+
+static void *mem_alloc(size_t size)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t span = guard_span(size, page);
+    uint8_t *base = mmap(NULL, span + 2*page, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        return NULL;
+    }
+    mprotect(base, page, PROT_NONE);
+    mprotect(base + page + span, page, PROT_NONE);
+    return base + page + span - size;
+}
+
+static void mem_free(void *mem, size_t size)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t span = guard_span(size, page);
+    munmap((uint8_t *)mem + size - span - page, span + 2*page);
+}
+#else
+static void *mem_alloc(size_t size)
+{
+    return calloc(1, size);
+}
+
+static void mem_free(void *mem, size_t size)
+{
+    (void)size;
+    free(mem);
+}
+#endif
+
+static struct Chip8Page *page_alloc(void)
+{
+    struct Chip8Page *page = mem_alloc(sizeof(struct Chip8Page));
+    atomic_init(&page->refs, 1);
+    return page;
+}
+
+static void page_release(struct Chip8Page *page)
+{
+    if (atomic_fetch_sub_explicit(&page->refs, 1, memory_order_acq_rel) == 1) {
+        mem_free(page, sizeof(struct Chip8Page));
+    }
+}
+
+/* Give c8 its own copy of a page it shares with other states */
+static void page_unshare(struct Chip8Page **slot)
+{
+    struct Chip8Page *page = page_alloc();
+    memcpy(page->data, (*slot)->data, CHIP8_PAGE_SIZE);
+    page_release(*slot);
+    *slot = page;
+}
+
 struct Chip8State *chip8state_create(uint8_t *rom, size_t rom_size)
 {
     struct Chip8State *c8 = calloc(1, sizeof(struct Chip8State));
-    c8->mem = calloc(CHIP8_MEM, sizeof(uint8_t));
+    uint8_t mem[CHIP8_MEM];
+    memset(mem, 0, sizeof(mem));
 
     /* initialize hex digit sprite data */
-    memcpy(c8->mem, sprite_data, 16*5);
+    memcpy(mem, sprite_data, 16*5);
 
     /* load program into memory */
-    c8->pc = 0x200;
-    memcpy(c8->mem + 0x200, rom, rom_size);
+    if (rom_size > CHIP8_MAX_ROM_SIZE) {
+        rom_size = CHIP8_MAX_ROM_SIZE;
+    }
+    c8->pc = CHIP8_PROG_START;
+    memcpy(mem + CHIP8_PROG_START, rom, rom_size);
+
+    for (int i = 0; i < CHIP8_PAGES; i++) {
+        c8->pages[i] = page_alloc();
+        memcpy(c8->pages[i]->data, mem + i * CHIP8_PAGE_SIZE, CHIP8_PAGE_SIZE);
+    }
 
-    /* c8->keyboard = SDL_GetKeyboardState(NULL); */
-    c8->keyboard = NULL;
+    c8->clock_speed = CHIP8_CLOCK_SPEED;
+    c8->rng = CHIP8_RNG_SEED;
+    chip8state_rehash(c8);
     return c8;
 }
 
 void chip8state_destroy(struct Chip8State *c8)
 {
-    free(c8->mem);
+    for (int i = 0; i < CHIP8_PAGES; i++) {
+        page_release(c8->pages[i]);
+    }
     free(c8);
 }
 
+/*
+ * Overwrite dst with src. Memory pages are shared and only copied when one
+ * side writes to them; the rest of the state, screen included, is a few
+ * hundred bytes and copied outright, which is cheaper than tracking it.
+ * src may be forked from several threads at once as long as nothing runs
+ * it meanwhile.
+ */
+void chip8state_copy(struct Chip8State *dst, const struct Chip8State *src)
+{
+    for (int i = 0; i < CHIP8_PAGES; i++) {
+        atomic_fetch_add_explicit(&src->pages[i]->refs, 1, memory_order_relaxed);
+        page_release(dst->pages[i]);
+    }
+    *dst = *src;
+}
+
+struct Chip8State *chip8state_fork(const struct Chip8State *c8)
+{
+    struct Chip8State *fork = malloc(sizeof(struct Chip8State));
+    *fork = *c8;
+    for (int i = 0; i < CHIP8_PAGES; i++) {
+        atomic_fetch_add_explicit(&c8->pages[i]->refs, 1, memory_order_relaxed);
+    }
+    return fork;
+}
+
+/*
+ * State hashing. Memory and the screen are hashed Zobrist style, as the
+ * XOR of a key per (location, value), and kept up to date on every write
+ * in run_opcode. The registers, stack and timers are only a few words and
+ * are folded in when the hash is read.
+ */
+#define HASH_SLOT_SCREEN CHIP8_MEM
+
+/* splitmix64 finalizer */
+static inline uint64_t hash_mix(uint64_t x)
+{
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+static inline uint64_t hash_key(uint32_t slot, uint8_t val)
+{
+    return hash_mix(((uint64_t)slot << 8) | val);
+}
+
+/* Key for a whole screen row; an empty row hashes to 0 */
+static inline uint64_t hash_row(int y, uint64_t row)
+{
+    uint64_t salt = hash_key(HASH_SLOT_SCREEN + y, 0);
+    return hash_mix(row ^ salt) ^ hash_mix(salt);
+}
+
+static inline void mem_write(struct Chip8State *c8, uint16_t addr, uint8_t val)
+{
+    addr &= CHIP8_ADDR_MASK;
+    struct Chip8Page **slot = &c8->pages[addr >> CHIP8_PAGE_SHIFT];
+    if (atomic_load_explicit(&(*slot)->refs, memory_order_acquire) > 1) {
+        page_unshare(slot);
+    }
+    uint8_t *byte = &(*slot)->data[addr & (CHIP8_PAGE_SIZE - 1)];
+    c8->mem_hash ^= hash_key(addr, *byte) ^ hash_key(addr, val);
+    *byte = val;
+}
+
+static inline void row_write(struct Chip8State *c8, int y, uint64_t row)
+{
+    c8->screen_hash ^= hash_row(y, c8->screen[y]) ^ hash_row(y, row);
+    c8->screen[y] = row;
+}
+
+/* Recompute the incremental hashes from scratch */
+void chip8state_rehash(struct Chip8State *c8)
+{
+    c8->mem_hash = 0;
+    for (uint32_t a = 0; a < CHIP8_MEM; a++) {
+        c8->mem_hash ^= hash_key(a, chip8_mem_read(c8, a));
+    }
+    c8->screen_hash = 0;
+    for (int y = 0; y < CHIP8_HEIGHT; y++) {
+        c8->screen_hash ^= hash_row(y, c8->screen[y]);
+    }
+}
+
+/* Value of a timer that was set to value at cycle set, in emulated time */
+static uint8_t timer_value(const struct Chip8State *c8, uint8_t value, uint64_t set)
+{
+    uint64_t ticks = (c8->cycles - set) * CHIP8_TIMER_HZ / c8->clock_speed;
+    return ticks >= value ? 0 : value - ticks;
+}
+
+uint8_t chip8state_delay_timer(const struct Chip8State *c8)
+{
+    return timer_value(c8, c8->delay_timer, c8->delay_set);
+}
+
+uint8_t chip8state_sound_timer(const struct Chip8State *c8)
+{
+    return timer_value(c8, c8->sound_timer, c8->sound_set);
+}
+
+/* First cycle at which the sound timer reads zero */
+uint64_t chip8state_sound_end(const struct Chip8State *c8)
+{
+    return c8->sound_set + ((uint64_t)c8->sound_timer * c8->clock_speed
+                            + CHIP8_TIMER_HZ - 1) / CHIP8_TIMER_HZ;
+}
+
+/* Position between ticks of a running timer, in 1/60ths of a cycle; 0 once
+ * it has run out, since a stopped timer never ticks again */
+static uint64_t timer_phase(const struct Chip8State *c8, uint8_t value, uint64_t set)
+{
+    if (timer_value(c8, value, set) == 0) {
+        return 0;
+    }
+    return (c8->cycles - set) * CHIP8_TIMER_HZ % c8->clock_speed;
+}
+
+/*
+ * 64-bit hash of everything that decides how the machine runs from here
+ * on: memory, screen, registers, stack, the RNG, the current timer values
+ * and how far each running timer is into its tick, and the cycle offset
+ * into the current frame (where keys are next read). The cycle count
+ * itself is left out so equal states reached at different times compare
+ * equal.
+ */
+uint64_t chip8state_hash(const struct Chip8State *c8)
+{
+    uint64_t words[6 + CHIP8_STACK / 4];
+    memset(words, 0, sizeof(words));
+    memcpy(words, c8->reg, sizeof(c8->reg));
+    words[2] = (uint64_t)c8->addr_reg | (uint64_t)c8->pc << 16
+        | (uint64_t)c8->stack_ptr << 32
+        | (uint64_t)chip8state_delay_timer(c8) << 40
+        | (uint64_t)chip8state_sound_timer(c8) << 48;
+    words[3] = c8->rng;
+    words[4] = timer_phase(c8, c8->delay_timer, c8->delay_set)
+        | timer_phase(c8, c8->sound_timer, c8->sound_set) << 32;
+    words[5] = c8->cycles - c8->frames * c8->clock_speed / CHIP8_TIMER_HZ;
+    memcpy(words + 6, c8->stack, sizeof(c8->stack));
+
+    uint64_t h = c8->mem_hash ^ c8->screen_hash;
+    for (size_t i = 0; i < sizeof(words) / sizeof(words[0]); i++) {
+        h = hash_mix(h ^ words[i]);
+    }
+    return h;
+}
+
+/*
+ * Draw the n byte sprite at I to (vx, vy), XORing it onto the screen and
+ * wrapping at the edges. VF is set to 1 if any lit pixel was turned off.
+ */
+static inline void draw_sprite(struct Chip8State *c8, uint8_t vx, uint8_t vy, int n)
+{
+    int x = vx & (CHIP8_WIDTH - 1);
+    int y = vy & (CHIP8_HEIGHT - 1);
+    uint64_t flipped = 0;
+    for (int r = 0; r < n; r++) {
+        /* place the sprite byte at x, wrapping around the right edge */
+        uint64_t bits = (uint64_t)chip8_mem_read(c8, c8->addr_reg + r) << 56;
+        bits = x ? (bits >> x) | (bits << (CHIP8_WIDTH - x)) : bits;
+        int row = (y + r) & (CHIP8_HEIGHT - 1);
+        flipped |= c8->screen[row] & bits;
+        row_write(c8, row, c8->screen[row] ^ bits);
+    }
+    c8->reg[0xF] = flipped != 0;
+}
+
 enum OpType run_opcode(struct Chip8State *c8, uint16_t op)
 {
     uint8_t hex[4];             /* opcode hex digits, most significant first */
@@ -66,12 +325,13 @@ enum OpType run_opcode(struct Chip8State *c8, uint16_t op)
     CHIP8_MATCH_OP(hex, 0, 0, 0xE, 0xE) {
         c8->pc = c8->stack[c8->stack_ptr];
         c8->stack[c8->stack_ptr] = 0;
-        c8->stack_ptr--;
+        c8->stack_ptr = (c8->stack_ptr - 1) & CHIP8_STACK_MASK;
         return 0;
     }
     /* 00E0 - clear display */
     CHIP8_MATCH_OP(hex, 0, 0, 0xE, 0) {
-        memset(c8->screen, 0, CHIP8_HEIGHT * CHIP8_WIDTH);
+        memset(c8->screen, 0, sizeof(c8->screen));
+        c8->screen_hash = 0;
         c8->pc += 2;
         return OP_DRAW;
     }
@@ -88,7 +348,7 @@ enum OpType run_opcode(struct Chip8State *c8, uint16_t op)
     }
     /* 2NNN - call subroutine at NNN */
     CHIP8_MATCH_OP(hex, 2, -1, -1, -1) {
-        c8->stack_ptr++;
+        c8->stack_ptr = (c8->stack_ptr + 1) & CHIP8_STACK_MASK;
         c8->stack[c8->stack_ptr] = c8->pc + 2;
         c8->pc = DIGITS2HEX3(hex[1], hex[2], hex[3]);
         return 0;
@@ -217,12 +477,12 @@ enum OpType run_opcode(struct Chip8State *c8, uint16_t op)
     }
     /* BNNN - Jumps to the address NNN plus V0. */
     CHIP8_MATCH_OP(hex, 0xB, -1, -1, -1) {
-        c8->pc = DIGITS2HEX3(hex[1], hex[2], hex[3]) + c8->reg[0];
+        c8->pc = (DIGITS2HEX3(hex[1], hex[2], hex[3]) + c8->reg[0]) & CHIP8_ADDR_MASK;
         return 0;
     }
     /* CXNN - VX = rand() & NN */
     CHIP8_MATCH_OP(hex, 0xC, -1, -1, -1) {
-        c8->reg[hex[1]] = DIGITS2HEX2(hex[2], hex[3]) & random_byte();
+        c8->reg[hex[1]] = DIGITS2HEX2(hex[2], hex[3]) & random_byte(c8);
         c8->pc += 2;
         return 0;
     }
@@ -230,41 +490,13 @@ enum OpType run_opcode(struct Chip8State *c8, uint16_t op)
     /* Each row of 8 pixels is read starting from memory location I; */
     /* VF is set to 1 if any screen pixels are flipped from set to unset, 0 otherwise */
     CHIP8_MATCH_OP(hex, 0xD, -1, -1, -1) {
-        uint8_t *sprite = c8->mem + c8->addr_reg;
-        int x = c8->reg[hex[1]];
-        int y = c8->reg[hex[2]];
-        /* printf("Drawing at (x, y) = (%d, %d)\n", x, y); */
-        int flipped = 0;
-        for (int r = 0; r < hex[3]; r++) {
-            x = c8->reg[hex[1]];
-            for (int c = 0; c < 8; c++) {
-                int val = (*sprite >> (7 - c)) & 1;
-
-                if (c8->screen[x][y] == PIXEL_ON && val) {
-                    flipped = 1;
-                    c8->screen[x][y] = PIXEL_OFF;
-                } else if (val) {
-                    c8->screen[x][y] = PIXEL_ON;
-                }
-                x++;
-                if (x >= CHIP8_WIDTH) {
-                    x = 0;
-                }
-            }
-            sprite++;
-            y++;
-            if (y >= CHIP8_HEIGHT) {
-                y = 0;
-            }
-        }
-        c8->reg[0xF] = flipped;
+        draw_sprite(c8, c8->reg[hex[1]], c8->reg[hex[2]], hex[3]);
         c8->pc += 2;
         return OP_DRAW;
     }
     /* EX9E - skip next if key stored in VX is pressed */
     CHIP8_MATCH_OP(hex, 0xE, -1, 9, 0xE) {
-        /* if (c8->keyboard[keymap[c8->reg[hex[1]]]]) { */
-        if (!c8->key_pressed(c8->reg[hex[1]])) {
+        if (!((c8->keys >> (c8->reg[hex[1]] & 0xF)) & 1)) {
             /* printf("Key was pressed, skipping...\n"); */
             c8->pc += 2;
         }
@@ -273,8 +505,7 @@ enum OpType run_opcode(struct Chip8State *c8, uint16_t op)
     }
     /* EXA1 - skip next if key stored in VX is not pressed */
     CHIP8_MATCH_OP(hex, 0xE, -1, 0xA, 1) {
-        /* if (!c8->keyboard[keymap[c8->reg[hex[1]]]]) { */
-        if (!c8->key_pressed(c8->reg[hex[1]])) {
+        if (!((c8->keys >> (c8->reg[hex[1]] & 0xF)) & 1)) {
             /* printf("Key was not pressed, skipping...\n"); */
             c8->pc += 2;
         }
@@ -283,17 +514,20 @@ enum OpType run_opcode(struct Chip8State *c8, uint16_t op)
     }
     /* FX07 - Sets VX to the value of the delay timer. */
     CHIP8_MATCH_OP(hex, 0xF, -1, 0, 7) {
-        c8->reg[hex[1]] = c8->delay_timer;
+        c8->reg[hex[1]] = chip8state_delay_timer(c8);
         c8->pc += 2;
         return 0;
     }
     /* FX0A - wait for a key press (blocking) and store it in VX */
     CHIP8_MATCH_OP(hex, 0xF, -1, 0, 0xA) {
+#ifdef DEBUG
         printf("Waiting for keypress..\n");
+#endif
         for (uint8_t i = 0; i < 16; i++) {
-            /* if (c8->keyboard[keymap[i]]) { */
-            if (c8->key_pressed(i)) {
+            if ((c8->keys >> i) & 1) {
+#ifdef DEBUG
                 printf("Key was pressed\n");
+#endif
                 c8->reg[hex[1]] = i;
                 c8->pc += 2;
                 break;
@@ -304,18 +538,20 @@ enum OpType run_opcode(struct Chip8State *c8, uint16_t op)
     /* FX15 - Sets the delay timer to VX.  */
     CHIP8_MATCH_OP(hex, 0xF, -1, 1, 5) {
         c8->delay_timer = c8->reg[hex[1]];
+        c8->delay_set = c8->cycles;
         c8->pc += 2;
         return 0;
     }
     /* FX18 - Sets the sound timer to VX. */
     CHIP8_MATCH_OP(hex, 0xF, -1, 1, 8) {
         c8->sound_timer = c8->reg[hex[1]];
+        c8->sound_set = c8->cycles;
         c8->pc += 2;
-        return 0;
+        return OP_SOUND;
     }
     /* FX1E - Adds VX to I. */
     CHIP8_MATCH_OP(hex, 0xF, -1, 1, 0xE) {
-        c8->addr_reg += c8->reg[hex[1]];
+        c8->addr_reg = (c8->addr_reg + c8->reg[hex[1]]) & CHIP8_ADDR_MASK;
         c8->pc += 2;
         return 0;
     }
@@ -324,34 +560,34 @@ enum OpType run_opcode(struct Chip8State *c8, uint16_t op)
         if (c8->reg[hex[1]] <= 0xF) {
             c8->addr_reg = 5 * c8->reg[hex[1]];
         } else {
+#ifdef DEBUG
             printf("unknown sprite\n");
+#endif
         }
         c8->pc += 2;
         return 0;
     }
     /* FX33 - Stores the binary-coded decimal representation of VX */
     CHIP8_MATCH_OP(hex, 0xF, -1, 3, 3) {
-        c8->mem[c8->addr_reg] = c8->reg[hex[1]] / 100;
-        c8->mem[c8->addr_reg + 1] = (c8->reg[hex[1]] / 10) % 10;
-        c8->mem[c8->addr_reg + 2] = c8->reg[hex[1]] % 10;
+        mem_write(c8, c8->addr_reg, c8->reg[hex[1]] / 100);
+        mem_write(c8, c8->addr_reg + 1, (c8->reg[hex[1]] / 10) % 10);
+        mem_write(c8, c8->addr_reg + 2, c8->reg[hex[1]] % 10);
         c8->pc += 2;
         return 0;
     }
     /* FX55 - Stores V0 to VX (including VX) in memory starting at address I. */
     CHIP8_MATCH_OP(hex, 0xF, -1, 5, 5) {
-        /* for (int i = 0; i <= hex[1]; i++) { */
-        /*     c8->mem[c8->addr_reg + i] = c8->reg[i]; */
-        /* } */
-        memcpy(c8->mem + c8->addr_reg, c8->reg, hex[1]+1);
+        for (int i = 0; i <= hex[1]; i++) {
+            mem_write(c8, c8->addr_reg + i, c8->reg[i]);
+        }
         c8->pc += 2;
         return 0;
     }
     /* FX65 - Fills V0 to VX (including VX) with values from memory starting at address I. */
     CHIP8_MATCH_OP(hex, 0xF, -1, 6, 5) {
-        /* for (int i = 0; i <= hex[1]; i++) { */
-        /*     c8->reg[i] = c8->mem[c8->addr_reg + i]; */
-        /* } */
-        memcpy(c8->reg, c8->mem + c8->addr_reg, hex[1]+1);
+        for (int i = 0; i <= hex[1]; i++) {
+            c8->reg[i] = chip8_mem_read(c8, c8->addr_reg + i);
+        }
         c8->pc += 2;
         return 0;
     }
@@ -361,30 +597,211 @@ enum OpType run_opcode(struct Chip8State *c8, uint16_t op)
 int load_rom(uint8_t *buf, FILE *rom)
 {
     size_t n = 0;
-    while (fread(buf + n, 1, 1, rom)) {
+    while (n < CHIP8_MAX_ROM_SIZE && fread(buf + n, 1, 1, rom)) {
         n++;
     }
     return n;
 }
 
+static inline uint16_t fetch(const struct Chip8State *c8, uint16_t addr)
+{
+    return (chip8_mem_read(c8, addr) << 8) + chip8_mem_read(c8, addr + 1);
+}
+
+#ifndef DEBUG
+/* fused sequences, only run outside DEBUG builds */
+/*
+ * Tail of a loop: 3XNN at pc followed by 1NNN. Skips the jump if VX == NN,
+ * otherwise jumps. Returns the instructions run, 1 or 2.
+ */
+static inline int skip_or_jump(struct Chip8State *c8, uint16_t pc, uint16_t op, uint16_t next)
+{
+    if (c8->reg[(op >> 8) & 0xF] == (op & 0xFF)) {
+        c8->pc = pc + 4;
+        return 1;
+    }
+    c8->pc = next & 0xFFF;
+    return 2;
+}
+
+/*
+ * DXYN at pc, fused with what follows it in TETRIS's collision loop: 3XNN
+ * (draw, then test VF or a coordinate) or 7XNN 3XNN 1NNN (draw in a counted
+ * loop). The draw runs on its own if neither follows or fits in room.
+ * Returns the instructions run.
+ */
+static int run_draw(struct Chip8State *c8, uint16_t pc, uint16_t op, uint64_t room, int *ops)
+{
+    draw_sprite(c8, c8->reg[(op >> 8) & 0xF], c8->reg[(op >> 4) & 0xF], op & 0xF);
+    *ops |= 1 << OP_DRAW;
+    c8->pc = pc + 2;
+    if (room < 2) {
+        return 1;
+    }
+    uint16_t next = fetch(c8, pc + 2);
+    uint8_t x = (next >> 8) & 0xF;
+    if ((next >> 12) == 0x3) {
+        c8->pc = c8->reg[x] == (next & 0xFF) ? pc + 6 : pc + 4;
+        *ops |= 1 << OP_OTHER;
+        return 2;
+    }
+    if ((next >> 12) == 0x7 && room >= 4) {
+        uint16_t test = fetch(c8, pc + 4);
+        uint16_t jump = fetch(c8, pc + 6);
+        if ((test >> 12) == 0x3 && (jump >> 12) == 0x1) {
+            c8->reg[x] += next & 0xFF;
+            *ops |= 1 << OP_OTHER;
+            return 2 + skip_or_jump(c8, pc + 4, test, jump);
+        }
+    }
+    return 1;
+}
+
+/*
+ * Superinstructions: the opcode sequences that dominate the pair profile
+ * from chip8-headless -p, decoded once and run as a unit. At the default
+ * clock they cover about 68% of TETRIS's instructions (mostly the DXYN
+ * forms) and 58% of PONG's (the FX07 wait loop). A sequence is
+ * only fused if all of it fits before end, so cycle counts and frame
+ * boundaries match single stepping exactly. Returns the instructions run,
+ * 0 if nothing at pc matched.
+ */
+static int run_fused(struct Chip8State *c8, uint64_t end, int *ops)
+{
+    uint64_t room = end - c8->cycles;
+    if (room < 2) {
+        return 0;
+    }
+    uint16_t pc = c8->pc;
+    uint16_t op = fetch(c8, pc);
+    uint16_t next = fetch(c8, pc + 2);
+    uint8_t x = (op >> 8) & 0xF;
+    int n = 0;
+
+    switch (op >> 12) {
+    case 0x3:
+        /* 3XNN 1NNN - loop until VX == NN */
+        if ((next >> 12) == 0x1) {
+            n = skip_or_jump(c8, pc, op, next);
+        }
+        break;
+    case 0x7: {
+        /* 7XNN 3XNN 1NNN - counted loop */
+        if ((next >> 12) != 0x3 || room < 3) {
+            break;
+        }
+        uint16_t jump = fetch(c8, pc + 4);
+        if ((jump >> 12) == 0x1) {
+            c8->reg[x] += op & 0xFF;
+            n = 1 + skip_or_jump(c8, pc + 2, next, jump);
+        }
+        break;
+    }
+    case 0xD:
+        n = run_draw(c8, pc, op, room, ops);
+        c8->cycles += n;
+        return n;
+    case 0xF: {
+        /* FX07 3XNN 1NNN - wait for the delay timer. While the jump leads
+         * back here, keep spinning without decoding again. */
+        if ((op & 0xFF) != 0x07 || (next >> 12) != 0x3 || room < 3) {
+            break;
+        }
+        uint16_t jump = fetch(c8, pc + 4);
+        if ((jump >> 12) != 0x1) {
+            break;
+        }
+        int spin = (jump & 0xFFF) == pc;
+        do {
+            c8->reg[x] = chip8state_delay_timer(c8);
+            int run = 1 + skip_or_jump(c8, pc + 2, next, jump);
+            c8->cycles += run;
+            n += run;
+        } while (spin && c8->pc == pc && end - c8->cycles >= 3);
+        *ops |= 1 << OP_OTHER;
+        return n;
+    }
+    }
+
+    if (n) {
+        c8->cycles += n;
+        *ops |= 1 << OP_OTHER;
+    }
+    return n;
+}
+#endif
+
+/*
+ * Run instructions until the cycle count reaches end, fusing sequences
+ * where they fit. Returns early right after an FX18, so the caller can see
+ * the cycle the sound timer was set at. Returns a mask with bit
+ * (1 << type) set for each OpType executed.
+ */
+int chip8state_run_until(struct Chip8State *c8, uint64_t end)
+{
+    int ops = 0;
+    while (c8->cycles < end) {
+#ifndef DEBUG
+        if (run_fused(c8, end, &ops)) {
+            continue;
+        }
+#endif
+        enum OpType type = fetch_and_run(c8);
+        ops |= 1 << type;
+        if (type == OP_SOUND) {
+            break;
+        }
+    }
+    return ops;
+}
+
+/* Run the instructions of the next emulated 60 Hz frame */
+int chip8state_run_frame(struct Chip8State *c8)
+{
+    uint64_t end = (c8->frames + 1) * c8->clock_speed / CHIP8_TIMER_HZ;
+    int ops = 0;
+    while (c8->cycles < end) {
+        ops |= chip8state_run_until(c8, end);
+    }
+    c8->frames++;
+    return ops;
+}
+
 enum OpType fetch_and_run(struct Chip8State *c8)
 {
-    uint16_t op = (c8->mem[c8->pc] << 8) + c8->mem[c8->pc+1];
+    uint16_t op = fetch(c8, c8->pc);
 
 #ifdef DEBUG
     print_opcode(op);
 #endif
 
     int res = run_opcode(c8, op);
+    c8->cycles++;
+#ifdef DEBUG
     if (res == OP_UNKNOWN) {
         printf("unrecognized opcode: %04x\n", op);
     }
+#endif
     return res;
 }
 
+/*
+ * Parse a clock speed argument. Timers and frames divide by it, so anything
+ * but a positive number is rejected with an error and 0 returned.
+ */
+uint32_t chip8_parse_clock_speed(const char *arg)
+{
+    char *end;
+    unsigned long speed = strtoul(arg, &end, 10);
+    if (arg[0] == '-' || end == arg || *end != 0 || speed == 0 || speed > UINT32_MAX) {
+        fprintf(stderr, "Bad clock speed: %s\n", arg);
+        return 0;
+    }
+    return speed;
+}
+
 int chip8state_init(struct Chip8State **c8, char *rom)
 {
-    srand(808);
     FILE *f = fopen(rom, "r");
     if (f == NULL) {
         fprintf(stderr, "Could not open file: %s\n", rom);
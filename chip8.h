@@ -1,17 +1,25 @@
 #ifndef CHIP8_H
 #define CHIP8_H
 
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdlib.h>
 /* #include "sdlctx.h" */
 
-#define PIXEL_ON 255
-#define PIXEL_OFF 0
 #define CHIP8_WIDTH 64
 #define CHIP8_HEIGHT 32
 #define CHIP8_MEM 4096
-#define CHIP8_STACK 24
-#define CHIP8_MAX_ROM_SIZE 4096
+#define CHIP8_ADDR_MASK (CHIP8_MEM - 1)
+#define CHIP8_PAGE_SHIFT 8
+#define CHIP8_PAGE_SIZE (1 << CHIP8_PAGE_SHIFT)
+#define CHIP8_PAGES (CHIP8_MEM / CHIP8_PAGE_SIZE)
+#define CHIP8_PROG_START 0x200
+#define CHIP8_STACK 32          /* power of two, stack_ptr wraps within it */
+#define CHIP8_STACK_MASK (CHIP8_STACK - 1)
+#define CHIP8_MAX_ROM_SIZE (CHIP8_MEM - CHIP8_PROG_START)
+#define CHIP8_CLOCK_SPEED 1000  /* default instructions per emulated second */
+#define CHIP8_TIMER_HZ 60
+#define CHIP8_RNG_SEED 808
 #define CHIP8_MATCH_OP(hex, d0, d1, d2, d3)     \
     if (((d0) < 0 || (hex)[0] == (d0))          \
         && ((d1) < 0 || (hex)[1] == (d1))       \
@@ -23,10 +31,17 @@
 #define DIG2HEX2(h) (((h)[1] << 4) + (h)[2])
 #define DIG2HEX3(h) (((h)[1] << 8) + ((h)[2] << 4) + (h)[3])
 
+/* A page of main memory, shared copy-on-write between forked states */
+struct Chip8Page
+{
+    atomic_int refs;            /* states referencing this page */
+    uint8_t data[CHIP8_PAGE_SIZE];
+};
+
 struct Chip8State
 {
-    /* memory */
-    uint8_t *mem;                /* main memory */
+    /* memory, read through chip8_mem_read() */
+    struct Chip8Page *pages[CHIP8_PAGES]; /* main memory */
     uint16_t stack[CHIP8_STACK]; /* the stack */
     uint8_t stack_ptr; /* index of top of the stack */
 
@@ -35,17 +50,29 @@ struct Chip8State
     uint16_t addr_reg;      /* address register "I" */
     uint16_t pc;            /* program counter */
 
-    /* timers, count down at 60 Hz */
-    uint8_t sound_timer;       /* sound timer - beeps when nonzero */
-    uint8_t delay_timer;       /* delay timer - can be set and read */
+    /* timers, count down at 60 Hz of emulated time from the cycle they were
+     * set at; read them through chip8state_{sound,delay}_timer() */
+    uint8_t sound_timer;       /* sound timer as last set - beeps when nonzero */
+    uint8_t delay_timer;       /* delay timer as last set - can be set and read */
+    uint64_t sound_set;        /* cycle the sound timer was set at */
+    uint64_t delay_set;        /* cycle the delay timer was set at */
+
+    /* emulated time */
+    uint64_t cycles;           /* instructions executed so far */
+    uint64_t frames;           /* 60 Hz frames run by chip8state_run_frame */
+    uint32_t clock_speed;      /* instructions per emulated second */
+
+    uint32_t rng;              /* CXNN random number state */
 
-    /* graphics data */
-    uint8_t screen[CHIP8_WIDTH][CHIP8_HEIGHT];
+    /* incremental hashes, see chip8state_hash() */
+    uint64_t mem_hash;
+    uint64_t screen_hash;
 
-    /* currently pressed keys */
-    const uint8_t *keyboard;
+    /* graphics data, one row per word, leftmost pixel in the top bit */
+    uint64_t screen[CHIP8_HEIGHT];
 
-    int (*key_pressed)(int key);
+    /* currently pressed keys, bit k set while key k is held */
+    uint16_t keys;
 };
 
 enum OpType
@@ -54,14 +81,39 @@ enum OpType
     OP_DRAW,
     OP_KEYPRESS,
     OP_WAIT,
+    OP_SOUND,
     OP_UNKNOWN,
 };
 
+extern const uint8_t sprite_data[16][5];
+
+/* I and the PC are masked on every access, so reads wrap at 4 KB */
+static inline uint8_t chip8_mem_read(const struct Chip8State *c8, uint16_t addr)
+{
+    addr &= CHIP8_ADDR_MASK;
+    return c8->pages[addr >> CHIP8_PAGE_SHIFT]->data[addr & (CHIP8_PAGE_SIZE - 1)];
+}
+
+static inline int chip8_pixel(const struct Chip8State *c8, int x, int y)
+{
+    return (c8->screen[y] >> (CHIP8_WIDTH - 1 - x)) & 1;
+}
+
 struct Chip8State *chip8state_create(uint8_t *rom, size_t rom_size);
+uint32_t chip8_parse_clock_speed(const char *arg);
 int chip8state_init(struct Chip8State **c8, char *rom);
 void chip8state_destroy(struct Chip8State *c8);
+void chip8state_copy(struct Chip8State *dst, const struct Chip8State *src);
+struct Chip8State *chip8state_fork(const struct Chip8State *c8);
 enum OpType run_opcode(struct Chip8State *c8, uint16_t op);
 enum OpType fetch_and_run(struct Chip8State *c8);
+int chip8state_run_until(struct Chip8State *c8, uint64_t end);
+int chip8state_run_frame(struct Chip8State *c8);
+void chip8state_rehash(struct Chip8State *c8);
+uint64_t chip8state_hash(const struct Chip8State *c8);
+uint8_t chip8state_delay_timer(const struct Chip8State *c8);
+uint8_t chip8state_sound_timer(const struct Chip8State *c8);
+uint64_t chip8state_sound_end(const struct Chip8State *c8);
 /* void draw(struct Chip8State *c8, struct SDLContext *ctx); */
 
 #endif
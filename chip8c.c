@@ -0,0 +1,289 @@
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "chip8.h"
+#include "proto.h"
+
+/*
+ * chip8c - stand-in client for chip8d. Opens one or more connections,
+ * creates (or attaches to) a session on each, optionally holds a key mask,
+ * rebuilds the screen from the row deltas and prints it once enough frames
+ * have arrived.
+ */
+
+struct Conn
+{
+    int fd;
+    uint32_t session;
+    uint64_t screen[CHIP8_HEIGHT];
+    long frames;
+    long rows;
+    uint8_t in[MSG_HEADER + MSG_MAX_PAYLOAD];
+    size_t in_len;
+};
+
+static int connect_to(const char *path)
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        perror(path);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int send_msg(int fd, uint8_t type, const void *payload, uint16_t len)
+{
+    uint8_t msg[MSG_HEADER + MSG_MAX_PAYLOAD];
+    msg_header(msg, type, len);
+    memcpy(msg + MSG_HEADER, payload, len);
+    size_t off = 0;
+    while (off < MSG_HEADER + (size_t)len) {
+        ssize_t n = send(fd, msg + off, MSG_HEADER + len - off, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("send");
+            return -1;
+        }
+        off += n;
+    }
+    return 0;
+}
+
+static size_t load_file(const char *path, uint8_t *buf, size_t max)
+{
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        fprintf(stderr, "Could not open file: %s\n", path);
+        return 0;
+    }
+    size_t n = fread(buf, 1, max, f);
+    fclose(f);
+    return n;
+}
+
+/* Apply one message to the connection; returns -1 on a server error */
+static int handle_message(struct Conn *c, uint8_t type, const uint8_t *p, uint16_t len)
+{
+    switch (type) {
+    case MSG_SESSION:
+        memcpy(&c->session, p, sizeof(c->session));
+        break;
+    case MSG_FRAME:
+        for (size_t off = 4; off + FRAME_ROW_SIZE <= len; off += FRAME_ROW_SIZE) {
+            memcpy(&c->screen[p[off] & (CHIP8_HEIGHT - 1)], p + off + 1, sizeof(uint64_t));
+            c->rows++;
+        }
+        c->frames++;
+        break;
+    case MSG_ERROR:
+        fprintf(stderr, "server error: %.*s\n", (int)len, (const char *)p);
+        return -1;
+    }
+    return 0;
+}
+
+static int conn_read(struct Conn *c)
+{
+    ssize_t n = read(c->fd, c->in + c->in_len, sizeof(c->in) - c->in_len);
+    if (n <= 0) {
+        if (n < 0 && errno == EINTR) {
+            return 0;
+        }
+        fprintf(stderr, "connection closed\n");
+        return -1;
+    }
+    c->in_len += n;
+
+    size_t off = 0;
+    while (c->in_len - off >= MSG_HEADER) {
+        uint16_t len = msg_len(c->in + off);
+        if (c->in_len - off < MSG_HEADER + (size_t)len) {
+            break;
+        }
+        if (handle_message(c, c->in[off], c->in + off + MSG_HEADER, len) != 0) {
+            return -1;
+        }
+        off += MSG_HEADER + len;
+    }
+    memmove(c->in, c->in + off, c->in_len - off);
+    c->in_len -= off;
+    return 0;
+}
+
+static void print_rows(const uint64_t *screen)
+{
+    for (int y = 0; y < CHIP8_HEIGHT; y++) {
+        for (int x = 0; x < CHIP8_WIDTH; x++) {
+            putchar((screen[y] >> (CHIP8_WIDTH - 1 - x)) & 1 ? '#' : '.');
+        }
+        putchar('\n');
+    }
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-s socket] [-n frames] [-k mask] [-m conns] [-q]\n"
+            "       (-c ROM [clock_speed] | -a session)\n"
+            "  -s socket  chip8d socket (default " CHIP8D_SOCKET ")\n"
+            "  -n frames  frames (one message per vblank) to wait for per connection\n"
+            "             (default 60)\n"
+            "  -k mask    hex key mask to hold once attached\n"
+            "  -m conns   open this many connections, each with its own session\n"
+            "  -q         don't print the final screen\n"
+            "  -c ROM     create a session running ROM\n"
+            "  -a session attach to an existing session\n",
+            prog);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *path = CHIP8D_SOCKET;
+    const char *rom = NULL;
+    uint32_t attach = 0;
+    long frames = 60;
+    long keys = -1;
+    int nconns = 1;
+    int quiet = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:n:k:m:qc:a:")) != -1) {
+        switch (opt) {
+        case 's':
+            path = optarg;
+            break;
+        case 'n':
+            frames = atol(optarg);
+            break;
+        case 'k':
+            keys = strtol(optarg, NULL, 16) & 0xFFFF;
+            break;
+        case 'm':
+            nconns = atoi(optarg);
+            break;
+        case 'q':
+            quiet = 1;
+            break;
+        case 'c':
+            rom = optarg;
+            break;
+        case 'a':
+            attach = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if ((rom == NULL) == (attach == 0) || nconns < 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    uint8_t create[sizeof(uint32_t) + CHIP8_MAX_ROM_SIZE];
+    uint16_t create_len = 0;
+    if (rom != NULL) {
+        uint32_t clock_speed = 0;
+        if (argc > optind) {
+            clock_speed = chip8_parse_clock_speed(argv[optind]);
+            if (clock_speed == 0) {
+                return 1;
+            }
+            if (clock_speed > CHIP8D_MAX_CLOCK_SPEED) {
+                fprintf(stderr, "Clock speed above %d: %s\n", CHIP8D_MAX_CLOCK_SPEED,
+                        argv[optind]);
+                return 1;
+            }
+        }
+        memcpy(create, &clock_speed, sizeof(clock_speed));
+        size_t n = load_file(rom, create + sizeof(clock_speed), CHIP8_MAX_ROM_SIZE);
+        if (n == 0) {
+            return 1;
+        }
+        create_len = sizeof(clock_speed) + n;
+    }
+
+    struct Conn *conns = calloc(nconns, sizeof(struct Conn));
+    struct pollfd *pfds = calloc(nconns, sizeof(struct pollfd));
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    for (int i = 0; i < nconns; i++) {
+        conns[i].fd = connect_to(path);
+        if (conns[i].fd < 0) {
+            return 1;
+        }
+        int res = rom != NULL
+            ? send_msg(conns[i].fd, MSG_CREATE, create, create_len)
+            : send_msg(conns[i].fd, MSG_ATTACH, &attach, sizeof(attach));
+        if (res != 0) {
+            return 1;
+        }
+        if (keys >= 0) {
+            uint16_t mask = keys;
+            send_msg(conns[i].fd, MSG_KEYS, &mask, sizeof(mask));
+        }
+        pfds[i].fd = conns[i].fd;
+        pfds[i].events = POLLIN;
+    }
+
+    int remaining = nconns;
+    while (remaining > 0) {
+        if (poll(pfds, nconns, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll");
+            return 1;
+        }
+        for (int i = 0; i < nconns; i++) {
+            if (pfds[i].fd < 0 || !(pfds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+                continue;
+            }
+            if (conn_read(&conns[i]) != 0) {
+                return 1;
+            }
+            /* the first frame is the full screen sent on attach */
+            if (conns[i].frames > frames) {
+                pfds[i].fd = -1;
+                remaining--;
+            }
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    long total_frames = 0, total_rows = 0;
+    for (int i = 0; i < nconns; i++) {
+        total_frames += conns[i].frames;
+        total_rows += conns[i].rows;
+        close(conns[i].fd);
+    }
+
+    if (!quiet) {
+        printf("session %u\n", conns[0].session);
+        print_rows(conns[0].screen);
+    }
+    fprintf(stderr, "%d connections, %ld frame messages, %ld rows, %.2f s\n",
+            nconns, total_frames, total_rows, secs);
+    free(conns);
+    free(pfds);
+    return 0;
+}
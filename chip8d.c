@@ -0,0 +1,605 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "chip8.h"
+#include "proto.h"
+
+/*
+ * chip8d - runs many headless sessions in one process.
+ *
+ * The main thread owns all sockets and an epoll loop. A 60 Hz timerfd
+ * drives the vblank: on each tick the worker threads step their shard of
+ * the sessions (session i belongs to worker i % workers) by one frame and
+ * build a message with the rows that changed, while the main thread waits.
+ * The main thread then hands every message to the clients attached to that
+ * session, even one with no rows, so clients see every vblank. Sessions
+ * are only touched by the main thread between ticks, so key masks and
+ * attaches need no locking.
+ *
+ * A session lives as long as some client is attached to it: when the last
+ * one detaches or disconnects it is destroyed and its slot freed. Session
+ * ids are never reused, so a stale id can't attach to someone else's game.
+ */
+
+#define MAX_EVENTS 64
+#define MAX_SESSIONS 1024
+#define OUT_LIMIT (256 * 1024)  /* queued bytes before frames are skipped */
+#define FRAME_MSG_MAX (MSG_HEADER + 4 + CHIP8_HEIGHT * FRAME_ROW_SIZE)
+
+struct Session
+{
+    uint32_t id;
+    int clients;                 /* attached clients */
+    struct Chip8State *c8;
+    uint64_t sent[CHIP8_HEIGHT]; /* screen as last sent to clients */
+    uint8_t msg[FRAME_MSG_MAX];  /* this tick's delta */
+    size_t msg_len;
+};
+
+struct Client
+{
+    int fd;
+    struct Session *session;
+    int want_out;               /* EPOLLOUT registered */
+    int resync;                 /* frames were skipped, send a full one */
+    uint8_t in[MSG_HEADER + MSG_MAX_PAYLOAD];
+    size_t in_len;
+    uint8_t *out;
+    size_t out_len;
+    size_t out_cap;
+};
+
+struct Server
+{
+    int epfd;
+    int listen_fd;
+    int timer_fd;
+
+    struct Session **sessions;
+    int nsessions;
+    int max_sessions;
+    uint32_t next_id;
+
+    struct Client **clients;
+    int nclients;
+    int max_clients;
+
+    /* worker pool, see worker() */
+    pthread_t *workers;
+    int nworkers;
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    uint64_t tick;
+    int pending;
+    int quit;
+};
+
+struct Worker
+{
+    struct Server *srv;
+    int id;
+};
+
+static volatile sig_atomic_t stop = 0;
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    stop = 1;
+}
+
+/* Step one session a frame and collect the rows that changed, if any */
+static void session_step(struct Session *s)
+{
+    struct Chip8State *c8 = s->c8;
+    chip8state_run_frame(c8);
+
+    uint8_t *p = s->msg + MSG_HEADER + 4;
+    for (int y = 0; y < CHIP8_HEIGHT; y++) {
+        if (c8->screen[y] != s->sent[y]) {
+            *p++ = y;
+            memcpy(p, &c8->screen[y], sizeof(uint64_t));
+            p += sizeof(uint64_t);
+            s->sent[y] = c8->screen[y];
+        }
+    }
+    /* sent even with no rows, so clients can count vblanks */
+    s->msg_len = p - s->msg;
+    uint32_t frame = c8->frames;
+    msg_header(s->msg, MSG_FRAME, s->msg_len - MSG_HEADER);
+    memcpy(s->msg + MSG_HEADER, &frame, sizeof(frame));
+}
+
+static void *worker(void *arg)
+{
+    struct Worker *w = arg;
+    struct Server *srv = w->srv;
+    uint64_t seen = 0;
+
+    pthread_mutex_lock(&srv->lock);
+    for (;;) {
+        while (srv->tick == seen && !srv->quit) {
+            pthread_cond_wait(&srv->start, &srv->lock);
+        }
+        if (srv->quit) {
+            break;
+        }
+        seen = srv->tick;
+        pthread_mutex_unlock(&srv->lock);
+
+        for (int i = w->id; i < srv->nsessions; i += srv->nworkers) {
+            session_step(srv->sessions[i]);
+        }
+
+        pthread_mutex_lock(&srv->lock);
+        if (--srv->pending == 0) {
+            pthread_cond_signal(&srv->done);
+        }
+    }
+    pthread_mutex_unlock(&srv->lock);
+    free(w);
+    return NULL;
+}
+
+/* Run one frame of every session on the workers and wait for them */
+static void run_tick(struct Server *srv)
+{
+    pthread_mutex_lock(&srv->lock);
+    srv->tick++;
+    srv->pending = srv->nworkers;
+    pthread_cond_broadcast(&srv->start);
+    while (srv->pending > 0) {
+        pthread_cond_wait(&srv->done, &srv->lock);
+    }
+    pthread_mutex_unlock(&srv->lock);
+}
+
+static void client_watch_out(struct Server *srv, struct Client *c, int on)
+{
+    if (c->want_out == on) {
+        return;
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLIN | (on ? EPOLLOUT : 0);
+    ev.data.ptr = c;
+    epoll_ctl(srv->epfd, EPOLL_CTL_MOD, c->fd, &ev);
+    c->want_out = on;
+}
+
+static void client_queue(struct Client *c, const uint8_t *buf, size_t len)
+{
+    if (c->out_len + len > c->out_cap) {
+        c->out_cap = (c->out_len + len) * 2;
+        c->out = realloc(c->out, c->out_cap);
+    }
+    memcpy(c->out + c->out_len, buf, len);
+    c->out_len += len;
+}
+
+static void client_full_frame(struct Client *c)
+{
+    struct Session *s = c->session;
+    uint8_t msg[FRAME_MSG_MAX];
+    uint8_t *p = msg + MSG_HEADER + 4;
+    for (int y = 0; y < CHIP8_HEIGHT; y++) {
+        *p++ = y;
+        memcpy(p, &s->sent[y], sizeof(uint64_t));
+        p += sizeof(uint64_t);
+    }
+    uint32_t frame = s->c8->frames;
+    msg_header(msg, MSG_FRAME, p - msg - MSG_HEADER);
+    memcpy(msg + MSG_HEADER, &frame, sizeof(frame));
+    client_queue(c, msg, p - msg);
+}
+
+static void client_error(struct Client *c, const char *text)
+{
+    uint8_t msg[MSG_HEADER + 128];
+    size_t len = strlen(text);
+    if (len > 128) {
+        len = 128;
+    }
+    msg_header(msg, MSG_ERROR, len);
+    memcpy(msg + MSG_HEADER, text, len);
+    client_queue(c, msg, MSG_HEADER + len);
+}
+
+/* Drop the client from its session, destroying the session if it was the
+ * last one attached */
+static void client_detach(struct Server *srv, struct Client *c)
+{
+    struct Session *s = c->session;
+    c->session = NULL;
+    if (s == NULL || --s->clients > 0) {
+        return;
+    }
+    for (int i = 0; i < srv->nsessions; i++) {
+        if (srv->sessions[i] == s) {
+            srv->sessions[i] = srv->sessions[--srv->nsessions];
+            break;
+        }
+    }
+    chip8state_destroy(s->c8);
+    free(s);
+}
+
+static void client_close(struct Server *srv, struct Client *c)
+{
+    client_detach(srv, c);
+    epoll_ctl(srv->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    for (int i = 0; i < srv->nclients; i++) {
+        if (srv->clients[i] == c) {
+            srv->clients[i] = srv->clients[--srv->nclients];
+            break;
+        }
+    }
+    free(c->out);
+    free(c);
+}
+
+/* Write what the socket takes; returns -1 if the client went away */
+static int client_flush(struct Server *srv, struct Client *c)
+{
+    while (c->out_len > 0) {
+        ssize_t n = send(c->fd, c->out, c->out_len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        memmove(c->out, c->out + n, c->out_len - n);
+        c->out_len -= n;
+    }
+    if (c->out_len == 0 && c->resync && c->session != NULL) {
+        c->resync = 0;
+        client_full_frame(c);
+        return client_flush(srv, c);
+    }
+    client_watch_out(srv, c, c->out_len > 0);
+    return 0;
+}
+
+static void client_attach(struct Server *srv, struct Client *c, struct Session *s)
+{
+    uint8_t msg[MSG_HEADER + 4];
+    s->clients++;
+    client_detach(srv, c);
+    c->session = s;
+    c->resync = 0;
+    msg_header(msg, MSG_SESSION, 4);
+    memcpy(msg + MSG_HEADER, &s->id, sizeof(s->id));
+    client_queue(c, msg, sizeof(msg));
+    client_full_frame(c);
+}
+
+static void handle_message(struct Server *srv, struct Client *c,
+                           uint8_t type, const uint8_t *payload, uint16_t len)
+{
+    switch (type) {
+    case MSG_CREATE: {
+        uint32_t clock_speed;
+        if (len < sizeof(clock_speed)) {
+            client_error(c, "short create message");
+            return;
+        }
+        memcpy(&clock_speed, payload, sizeof(clock_speed));
+        if (clock_speed > CHIP8D_MAX_CLOCK_SPEED) {
+            client_error(c, "clock speed too high");
+            return;
+        }
+        if (srv->nsessions == srv->max_sessions) {
+            client_error(c, "too many sessions");
+            return;
+        }
+        struct Session *s = calloc(1, sizeof(struct Session));
+        s->c8 = chip8state_create((uint8_t *)payload + sizeof(clock_speed),
+                                  len - sizeof(clock_speed));
+        if (clock_speed != 0) {
+            s->c8->clock_speed = clock_speed;
+        }
+        s->id = srv->next_id++;
+        srv->sessions[srv->nsessions++] = s;
+        client_attach(srv, c, s);
+        break;
+    }
+    case MSG_ATTACH: {
+        uint32_t id;
+        if (len < sizeof(id)) {
+            client_error(c, "short attach message");
+            return;
+        }
+        memcpy(&id, payload, sizeof(id));
+        struct Session *s = NULL;
+        for (int i = 0; i < srv->nsessions && s == NULL; i++) {
+            s = srv->sessions[i]->id == id ? srv->sessions[i] : NULL;
+        }
+        if (s == NULL) {
+            client_error(c, "no such session");
+            return;
+        }
+        client_attach(srv, c, s);
+        break;
+    }
+    case MSG_KEYS: {
+        uint16_t keys;
+        if (len < sizeof(keys) || c->session == NULL) {
+            client_error(c, "keys without a session");
+            return;
+        }
+        memcpy(&keys, payload, sizeof(keys));
+        c->session->c8->keys = keys;
+        break;
+    }
+    default:
+        client_error(c, "unknown message");
+        break;
+    }
+}
+
+static void client_read(struct Server *srv, struct Client *c)
+{
+    for (;;) {
+        ssize_t n = read(c->fd, c->in + c->in_len, sizeof(c->in) - c->in_len);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+            client_close(srv, c);
+            return;
+        }
+        if (n < 0) {
+            break;
+        }
+        c->in_len += n;
+
+        size_t off = 0;
+        while (c->in_len - off >= MSG_HEADER) {
+            uint16_t len = msg_len(c->in + off);
+            if (c->in_len - off < MSG_HEADER + (size_t)len) {
+                break;
+            }
+            handle_message(srv, c, c->in[off], c->in + off + MSG_HEADER, len);
+            off += MSG_HEADER + len;
+        }
+        memmove(c->in, c->in + off, c->in_len - off);
+        c->in_len -= off;
+    }
+    if (client_flush(srv, c) != 0) {
+        client_close(srv, c);
+    }
+}
+
+static void accept_clients(struct Server *srv)
+{
+    for (;;) {
+        int fd = accept4(srv->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            return;
+        }
+        if (srv->nclients == srv->max_clients) {
+            srv->max_clients *= 2;
+            srv->clients = realloc(srv->clients, srv->max_clients * sizeof(struct Client *));
+        }
+        struct Client *c = calloc(1, sizeof(struct Client));
+        c->fd = fd;
+        srv->clients[srv->nclients++] = c;
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = c;
+        epoll_ctl(srv->epfd, EPOLL_CTL_ADD, fd, &ev);
+    }
+}
+
+/* Hand this tick's deltas to the attached clients */
+static void broadcast(struct Server *srv)
+{
+    for (int i = 0; i < srv->nclients; i++) {
+        struct Client *c = srv->clients[i];
+        struct Session *s = c->session;
+        if (s == NULL || c->resync) {
+            continue;
+        }
+        if (c->out_len + s->msg_len > OUT_LIMIT) {
+            /* slow reader: skip deltas, catch up with a full frame later */
+            c->resync = 1;
+            continue;
+        }
+        client_queue(c, s->msg, s->msg_len);
+    }
+    for (int i = 0; i < srv->nclients; i++) {
+        struct Client *c = srv->clients[i];
+        if (c->out_len > 0 && client_flush(srv, c) != 0) {
+            client_close(srv, c);
+            i--;
+        }
+    }
+}
+
+static int listen_on(const char *path)
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", path);
+        close(fd);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 128) != 0) {
+        perror(path);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-s socket] [-j workers] [-m max_sessions]\n"
+            "  -s socket  Unix socket to listen on (default " CHIP8D_SOCKET ")\n"
+            "  -j workers emulation threads (default: online CPUs)\n"
+            "  -m max     session limit (default %d)\n",
+            prog, MAX_SESSIONS);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *path = CHIP8D_SOCKET;
+    struct Server srv;
+    memset(&srv, 0, sizeof(srv));
+    srv.nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+    srv.max_sessions = MAX_SESSIONS;
+    srv.next_id = 1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:j:m:")) != -1) {
+        switch (opt) {
+        case 's':
+            path = optarg;
+            break;
+        case 'j':
+            srv.nworkers = atoi(optarg);
+            break;
+        case 'm':
+            srv.max_sessions = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (srv.nworkers < 1 || srv.max_sessions < 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    srv.listen_fd = listen_on(path);
+    if (srv.listen_fd < 0) {
+        return 1;
+    }
+    srv.timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    struct itimerspec its;
+    its.it_interval.tv_sec = 0;
+    its.it_interval.tv_nsec = 1000000000L / CHIP8_TIMER_HZ;
+    its.it_value = its.it_interval;
+    timerfd_settime(srv.timer_fd, 0, &its, NULL);
+
+    srv.epfd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = &srv.listen_fd;
+    epoll_ctl(srv.epfd, EPOLL_CTL_ADD, srv.listen_fd, &ev);
+    ev.data.ptr = &srv.timer_fd;
+    epoll_ctl(srv.epfd, EPOLL_CTL_ADD, srv.timer_fd, &ev);
+
+    srv.sessions = calloc(srv.max_sessions, sizeof(struct Session *));
+    srv.max_clients = 64;
+    srv.clients = calloc(srv.max_clients, sizeof(struct Client *));
+
+    pthread_mutex_init(&srv.lock, NULL);
+    pthread_cond_init(&srv.start, NULL);
+    pthread_cond_init(&srv.done, NULL);
+    srv.workers = calloc(srv.nworkers, sizeof(pthread_t));
+    for (int i = 0; i < srv.nworkers; i++) {
+        struct Worker *w = malloc(sizeof(struct Worker));
+        w->srv = &srv;
+        w->id = i;
+        pthread_create(&srv.workers[i], NULL, worker, w);
+    }
+
+    fprintf(stderr, "chip8d listening on %s with %d workers\n", path, srv.nworkers);
+
+    struct epoll_event events[MAX_EVENTS];
+    while (!stop) {
+        int n = epoll_wait(srv.epfd, events, MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("epoll_wait");
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            void *ptr = events[i].data.ptr;
+            if (ptr == &srv.listen_fd) {
+                accept_clients(&srv);
+            } else if (ptr == &srv.timer_fd) {
+                uint64_t expirations;
+                if (read(srv.timer_fd, &expirations, sizeof(expirations)) > 0) {
+                    /* one frame per wakeup: an overloaded server runs slow
+                     * rather than bursting */
+                    run_tick(&srv);
+                    broadcast(&srv);
+                }
+            } else {
+                struct Client *c = ptr;
+                /* the client may have been closed earlier in this batch */
+                int alive = 0;
+                for (int j = 0; j < srv.nclients; j++) {
+                    alive |= srv.clients[j] == c;
+                }
+                if (!alive) {
+                    continue;
+                }
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                    client_read(&srv, c);
+                } else if (events[i].events & EPOLLOUT) {
+                    if (client_flush(&srv, c) != 0) {
+                        client_close(&srv, c);
+                    }
+                }
+            }
+        }
+    }
+
+    pthread_mutex_lock(&srv.lock);
+    srv.quit = 1;
+    pthread_cond_broadcast(&srv.start);
+    pthread_mutex_unlock(&srv.lock);
+    for (int i = 0; i < srv.nworkers; i++) {
+        pthread_join(srv.workers[i], NULL);
+    }
+
+    while (srv.nclients > 0) {
+        client_close(&srv, srv.clients[0]);
+    }
+    for (int i = 0; i < srv.nsessions; i++) {
+        chip8state_destroy(srv.sessions[i]->c8);
+        free(srv.sessions[i]);
+    }
+    free(srv.sessions);
+    free(srv.clients);
+    free(srv.workers);
+    close(srv.timer_fd);
+    close(srv.listen_fd);
+    close(srv.epfd);
+    unlink(path);
+    return 0;
+}
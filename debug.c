@@ -8,7 +8,8 @@ struct Chip8State;
 void print_registers(struct Chip8State *c8)
 {
     printf("PC = %04X\tI = %04X\tDEL = %02X\tSND = %02X\n",
-           c8->pc, c8->addr_reg, c8->delay_timer, c8->sound_timer);
+           c8->pc, c8->addr_reg, chip8state_delay_timer(c8),
+           chip8state_sound_timer(c8));
     for (int i = 0; i < 16; i += 4) {
         printf("V%X = %02X  \t", i, c8->reg[i]);
         printf("V%X = %02X  \t", i+1, c8->reg[i+1]);
@@ -30,7 +31,7 @@ void print_screen(struct Chip8State *c8)
 {
     for (int y = 0; y < CHIP8_HEIGHT; y++) {
         for (int x = 0; x < CHIP8_WIDTH; x++) {
-            if (c8->screen[x][y]) {
+            if (chip8_pixel(c8, x, y)) {
                 printf("#");
             } else {
                 printf(".");
@@ -44,8 +45,7 @@ void print_keyboard(struct Chip8State *c8)
 {
     printf("Keys: ");
     for (int k = 0; k < 16; k++) {
-        /* if (c8->keyboard[keymap[k]]) { */
-        if (c8->key_pressed(k)) {
+        if ((c8->keys >> k) & 1) {
             printf("1");
         } else {
             printf("0");
@@ -0,0 +1,334 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "chip8.h"
+#include "raster.h"
+
+/*
+ * chip8-headless - runs ROMs without SDL. Used to benchmark the core, to
+ * profile which opcode sequences are worth fusing and to dump frames.
+ */
+
+#define PAIR_TOP 20
+
+/* Opcode forms the profiler tells apart */
+static const char *forms[] = {
+    "00E0", "00EE", "0NNN", "1NNN", "2NNN", "3XNN", "4XNN", "5XY0",
+    "6XNN", "7XNN", "8XY0", "8XY1", "8XY2", "8XY3", "8XY4", "8XY5",
+    "8XY6", "8XY7", "8XYE", "9XY0", "ANNN", "BNNN", "CXNN", "DXYN",
+    "EX9E", "EXA1", "FX07", "FX0A", "FX15", "FX18", "FX1E", "FX29",
+    "FX33", "FX55", "FX65", "????",
+};
+#define NFORMS (sizeof(forms) / sizeof(forms[0]))
+
+/* Index into forms of an opcode, e.g. 0xD123 -> "DXYN" */
+static int op_form(uint16_t op)
+{
+    static const uint8_t low8[16] = {10, 11, 12, 13, 14, 15, 16, 17, 35, 35, 35, 35, 35, 35, 18, 35};
+    static const uint8_t top[16] = {0, 3, 4, 5, 6, 7, 8, 9, 0, 19, 20, 21, 22, 23, 0, 0};
+    switch (op >> 12) {
+    case 0x0:
+        return op == 0x00E0 ? 0 : op == 0x00EE ? 1 : 2;
+    case 0x8:
+        return low8[op & 0xF];
+    case 0xE:
+        return (op & 0xFF) == 0x9E ? 24 : (op & 0xFF) == 0xA1 ? 25 : 35;
+    case 0xF:
+        switch (op & 0xFF) {
+        case 0x07: return 26;
+        case 0x0A: return 27;
+        case 0x15: return 28;
+        case 0x18: return 29;
+        case 0x1E: return 30;
+        case 0x29: return 31;
+        case 0x33: return 32;
+        case 0x55: return 33;
+        case 0x65: return 34;
+        }
+        return 35;
+    }
+    return top[op >> 12];
+}
+
+struct Pair
+{
+    int first;
+    int second;
+    long count;
+};
+
+static int pair_cmp(const void *a, const void *b)
+{
+    const struct Pair *x = a, *y = b;
+    return (x->count < y->count) - (x->count > y->count);
+}
+
+/*
+ * Count consecutive opcode pairs by form, stepping one instruction at a
+ * time so the counts are of what actually ran, taken branches included.
+ */
+static void profile(struct Chip8State *c8, long frames)
+{
+    static long counts[NFORMS][NFORMS];
+    long total = 0;
+    int prev = -1;
+
+    uint64_t end = frames * c8->clock_speed / CHIP8_TIMER_HZ;
+    while (c8->cycles < end) {
+        uint16_t op = (chip8_mem_read(c8, c8->pc) << 8) | chip8_mem_read(c8, c8->pc + 1);
+        int form = op_form(op);
+        if (prev >= 0) {
+            counts[prev][form]++;
+            total++;
+        }
+        prev = form;
+        fetch_and_run(c8);
+    }
+
+    struct Pair pairs[NFORMS * NFORMS];
+    int n = 0;
+    for (size_t i = 0; i < NFORMS; i++) {
+        for (size_t j = 0; j < NFORMS; j++) {
+            if (counts[i][j]) {
+                pairs[n].first = i;
+                pairs[n].second = j;
+                pairs[n].count = counts[i][j];
+                n++;
+            }
+        }
+    }
+    qsort(pairs, n, sizeof(struct Pair), pair_cmp);
+    printf("%ld instruction pairs, %d distinct\n", total, n);
+    for (int i = 0; i < n && i < PAIR_TOP; i++) {
+        printf("%6.2f%%  %s %s\n", 100.0 * pairs[i].count / total,
+               forms[pairs[i].first], forms[pairs[i].second]);
+    }
+}
+
+/*
+ * Check that pattern is safe to hand to snprintf with the frame number:
+ * %% and at most one %d or %ld conversion, with flags, width and
+ * precision but no *. Returns 1 if the conversion takes a long, 0 if an
+ * int or there is none, -1 if pattern is rejected.
+ */
+static int check_pattern(const char *pattern)
+{
+    int convs = 0, is_long = 0;
+    for (const char *p = pattern; *p != '\0'; p++) {
+        if (*p != '%') {
+            continue;
+        }
+        p++;
+        if (*p == '%') {
+            continue;
+        }
+        p += strspn(p, "-+ #0");
+        p += strspn(p, "0123456789");
+        if (*p == '.') {
+            p++;
+            p += strspn(p, "0123456789");
+        }
+        if (*p == 'l') {
+            is_long = 1;
+            p++;
+        }
+        if (*p != 'd' || ++convs > 1) {
+            return -1;
+        }
+    }
+    return is_long;
+}
+
+/* Write the screen to the file named by pattern (checked by check_pattern,
+ * given the frame number), as PNG if it ends in .png, PPM otherwise */
+static int dump_frame(struct Raster *r, const uint64_t *screen, const char *pattern,
+                      int is_long, long frame)
+{
+    char path[4096];
+    if (is_long) {
+        snprintf(path, sizeof(path), pattern, frame);
+    } else {
+        snprintf(path, sizeof(path), pattern, (int)frame);
+    }
+    FILE *f = fopen(path, "wb");
+    if (f == NULL) {
+        fprintf(stderr, "Could not open file: %s\n", path);
+        return 1;
+    }
+    raster_draw(r, screen);
+    size_t len = strlen(path);
+    int res = len > 4 && strcmp(path + len - 4, ".png") == 0
+        ? raster_write_png(r, f) : raster_write_ppm(r, f);
+    if (fclose(f) != 0 || res != 0) {
+        fprintf(stderr, "Error writing file: %s\n", path);
+        return 1;
+    }
+    return 0;
+}
+
+/* "RRGGBB" in hex to a raster color */
+static uint32_t parse_color(const char *hex)
+{
+    unsigned long rgb = strtoul(hex, NULL, 16);
+    return raster_rgb(rgb >> 16, rgb >> 8, rgb);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-n frames] [-k mask] [-p | -1] [-s]\n"
+            "       [-w pattern [-e frames] [-x scale] [-c off,on]] ROM [clock_speed]\n"
+            "  -n frames  emulated frames to run (default 600)\n"
+            "  -k mask    hex key mask held for the whole run\n"
+            "  -p         print the most frequent opcode pairs\n"
+            "  -1         step one instruction at a time, no fused sequences\n"
+            "  -s         print the final screen\n"
+            "  -w pattern write frames to files named by pattern, given the frame\n"
+            "             number for at most one %%d or %%ld (e.g. out/%%05ld.png);\n"
+            "             .png for PNG, else PPM\n"
+            "  -e frames  write every Nth frame (default: only the last)\n"
+            "  -x scale   pixels per CHIP-8 pixel in written frames (default 1)\n"
+            "  -c off,on  hex RRGGBB palette (default 000000,ffffff)\n",
+            prog);
+}
+
+int main(int argc, char *argv[])
+{
+    long frames = 600;
+    uint16_t keys = 0;
+    int do_profile = 0;
+    int single_step = 0;
+    int show_screen = 0;
+    const char *pattern = NULL;
+    long dump_every = 0;
+    int scale = 1;
+    uint32_t off = raster_rgb(0, 0, 0);
+    uint32_t on = raster_rgb(255, 255, 255);
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:k:p1sw:e:x:c:")) != -1) {
+        switch (opt) {
+        case 'n':
+            frames = atol(optarg);
+            break;
+        case 'k':
+            keys = strtol(optarg, NULL, 16);
+            break;
+        case 'p':
+            do_profile = 1;
+            break;
+        case '1':
+            single_step = 1;
+            break;
+        case 's':
+            show_screen = 1;
+            break;
+        case 'w':
+            pattern = optarg;
+            break;
+        case 'e':
+            dump_every = atol(optarg);
+            break;
+        case 'x':
+            scale = atoi(optarg);
+            break;
+        case 'c': {
+            const char *comma = strchr(optarg, ',');
+            off = parse_color(optarg);
+            if (comma != NULL) {
+                on = parse_color(comma + 1);
+            }
+            break;
+        }
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind >= argc) {
+        usage(argv[0]);
+        return 1;
+    }
+    int is_long = 0;
+    if (pattern != NULL) {
+        is_long = check_pattern(pattern);
+        if (is_long < 0) {
+            fprintf(stderr, "Bad file pattern: %s (use one %%d or %%ld for the frame)\n",
+                    pattern);
+            return 1;
+        }
+    }
+
+    struct Chip8State *c8 = NULL;
+    if (chip8state_init(&c8, argv[optind]) != 0) {
+        return 1;
+    }
+    if (argc > optind + 1) {
+        c8->clock_speed = chip8_parse_clock_speed(argv[optind + 1]);
+        if (c8->clock_speed == 0) {
+            return 1;
+        }
+    }
+    c8->keys = keys;
+
+    struct Raster raster;
+    if (pattern != NULL && raster_init(&raster, scale, off, on) != 0) {
+        fprintf(stderr, "Bad scale: %d\n", scale);
+        return 1;
+    }
+
+    if (do_profile) {
+        profile(c8, frames);
+        chip8state_destroy(c8);
+        return 0;
+    }
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    long written = 0;
+    if (pattern != NULL) {
+        for (long f = 1; f <= frames; f++) {
+            chip8state_run_frame(c8);
+            if ((dump_every > 0 && f % dump_every == 0) || f == frames) {
+                if (dump_frame(&raster, c8->screen, pattern, is_long, f) != 0) {
+                    return 1;
+                }
+                written++;
+            }
+        }
+        raster_free(&raster);
+    } else if (single_step) {
+        uint64_t end = frames * c8->clock_speed / CHIP8_TIMER_HZ;
+        while (c8->cycles < end) {
+            fetch_and_run(c8);
+        }
+        /* count the frames too, the state hash covers the frame offset */
+        c8->frames = frames;
+    } else {
+        for (long f = 0; f < frames; f++) {
+            chip8state_run_frame(c8);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    double secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    printf("%llu instructions in %.3f s, %.1f M instructions/s, %.0fx realtime\n",
+           (unsigned long long)c8->cycles, secs, c8->cycles / secs / 1e6,
+           frames / (double)CHIP8_TIMER_HZ / secs);
+    if (written > 0) {
+        printf("%ld frames written, %.0f frames/s\n", written, written / secs);
+    }
+    printf("state hash %016llx\n", (unsigned long long)chip8state_hash(c8));
+
+    if (show_screen) {
+        for (int y = 0; y < CHIP8_HEIGHT; y++) {
+            for (int x = 0; x < CHIP8_WIDTH; x++) {
+                putchar(chip8_pixel(c8, x, y) ? '#' : '.');
+            }
+            putchar('\n');
+        }
+    }
+    chip8state_destroy(c8);
+    return 0;
+}
@@ -3,7 +3,9 @@
 #include <unistd.h>
 
 #include "chip8.h"
+#include "raster.h"
 #include "sdlctx.h"
+#include "telemetry.h"
 
 const uint8_t keymap[16] = {
     SDL_SCANCODE_B,                          /* 0 */
@@ -25,131 +27,315 @@ const uint8_t keymap[16] = {
 };
 
 
-int key_pressed(int key)
+/* Mask of the CHIP-8 keys currently held down */
+uint16_t read_keys(void)
 {
     const uint8_t *keyboard = SDL_GetKeyboardState(NULL);
-    return keyboard[keymap[key]];
+    uint16_t keys = 0;
+    for (int k = 0; k < 16; k++) {
+        keys |= (uint16_t)(keyboard[keymap[k]] != 0) << k;
+    }
+    return keys;
+}
+
+void draw(struct Chip8State *c8, struct SDLContext *ctx, struct Raster *raster)
+{
+    raster_draw(raster, c8->screen);
+    SDL_UpdateTexture(ctx->screen, NULL, raster->pixels, raster->width * sizeof(uint32_t));
+    SDL_RenderCopy(ctx->rndr, ctx->screen, NULL, NULL);
+}
+
+/* Send a beep edge at cycle, as a sample offset from the frame's start */
+static void beep_at(struct SDLContext *ctx, const struct Chip8State *c8,
+                    uint64_t start, uint64_t cycle, int on)
+{
+    sdl_beep(ctx, on, c8->frames, (cycle - start) * SOUND_FREQ / c8->clock_speed);
 }
 
-void draw(struct Chip8State *c8, struct SDLContext *ctx)
+/*
+ * chip8state_run_frame, but stopping at each FX18 to time the beep edges
+ * to the cycle: on or off where the sound timer is set, off where it runs
+ * out. The frame runs in a burst, so each edge goes out with its offset
+ * into the frame and the audio callback spaces them the same way.
+ */
+static int run_frame_sound(struct Chip8State *c8, struct SDLContext *ctx, int *beeping)
 {
-    SDL_Renderer *rndr = ctx->rndr;
-    /* Clear to background color */
-    SDL_SetRenderDrawColor(rndr, BACKGROUND_R, BACKGROUND_G, BACKGROUND_B, 255);
-    SDL_RenderClear(rndr);
-
-    /* Draw foreground pixels */
-    SDL_SetRenderDrawColor(rndr, FOREGROUND_R, FOREGROUND_G, FOREGROUND_B, 255);
-    SDL_Rect p;
-    p.w = CHIP8_SCALE;
-    p.h = CHIP8_SCALE;
-    for (int x = 0; x < CHIP8_WIDTH; x++) {
-        for (int y = 0; y < CHIP8_HEIGHT; y++) {
-            if (c8->screen[x][y] == PIXEL_ON) {
-                p.x = x * CHIP8_SCALE;
-                p.y = y * CHIP8_SCALE;
-                SDL_RenderFillRect(rndr, &p);
+    uint64_t start = c8->cycles;
+    uint64_t end = (c8->frames + 1) * c8->clock_speed / CHIP8_TIMER_HZ;
+    int ops = 0;
+
+    /* fast-forward sends no edges, catch up with the timer after it */
+    int on = chip8state_sound_timer(c8) != 0;
+    if (on != *beeping) {
+        beep_at(ctx, c8, start, start, on);
+        *beeping = on;
+    }
+    while (c8->cycles < end) {
+        uint64_t expiry = chip8state_sound_end(c8);
+        int seg = chip8state_run_until(c8, end);
+        ops |= seg;
+
+        /* the segment ends right after an FX18, if it ran one */
+        uint64_t stop = seg & (1 << OP_SOUND) ? c8->sound_set : c8->cycles;
+        if (*beeping && expiry <= stop) {
+            beep_at(ctx, c8, start, expiry, 0);
+            *beeping = 0;
+        }
+        if (seg & (1 << OP_SOUND)) {
+            on = c8->sound_timer != 0;
+            if (on != *beeping) {
+                beep_at(ctx, c8, start, c8->sound_set, on);
+                *beeping = on;
             }
         }
     }
-    SDL_RenderPresent(rndr);
+    c8->frames++;
+    return ops;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-fo] [-n frames] [-r frames] [-t file] ROM [clock_speed]\n"
+            "  -f         start in fast-forward (toggle with Tab)\n"
+            "  -n frames  when fast-forwarding, present every Nth frame\n"
+            "             instead of at most once per display refresh\n"
+            "  -r frames  run ahead this many frames with the current input\n"
+            "             and present the result, hiding the ROM's input lag\n"
+            "  -o         show the telemetry overlay (toggle with F1): p50 and\n"
+            "             p99 of emulation (E), display (D) and sleep overshoot\n"
+            "             (F) in us, instructions per frame (C) and key to\n"
+            "             present latency (A) in us\n"
+            "  -t file    write telemetry histograms to file as CSV on exit\n",
+            prog);
 }
 
 int main(int argc, char *argv[])
 {
-    if (argc < 2) {
+    int fast_forward = 0;
+    int render_every = 0;
+    int run_ahead = 0;
+    int overlay = 0;
+    const char *telemetry_csv = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "fn:r:ot:")) != -1) {
+        switch (opt) {
+        case 'f':
+            fast_forward = 1;
+            break;
+        case 'n':
+            render_every = atoi(optarg);
+            break;
+        case 'r':
+            run_ahead = atoi(optarg);
+            break;
+        case 'o':
+            overlay = 1;
+            break;
+        case 't':
+            telemetry_csv = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind >= argc) {
         fprintf(stderr, "No ROM file specified\n");
         return 1;
     }
 
+    uint32_t clock_speed = CHIP8_CLOCK_SPEED;
+    if (argc > optind + 1) {
+        clock_speed = chip8_parse_clock_speed(argv[optind + 1]);
+        if (clock_speed == 0) {
+            return 1;
+        }
+    }
+
     struct Chip8State *c8 = NULL;
-    chip8state_init(&c8, argv[1]);
-    c8->key_pressed = key_pressed;
+    if (chip8state_init(&c8, argv[optind]) != 0) {
+        return 1;
+    }
 
     struct SDLContext ctx;
     if (sdl_init(&ctx, CHIP8_SCALE*CHIP8_WIDTH, CHIP8_SCALE*CHIP8_HEIGHT) != 0) {
         return 1;
     }
+    struct Raster raster;
+    if (raster_init(&raster, CHIP8_SCALE,
+                    raster_rgb(BACKGROUND_R, BACKGROUND_G, BACKGROUND_B),
+                    raster_rgb(FOREGROUND_R, FOREGROUND_G, FOREGROUND_B)) != 0) {
+        return 1;
+    }
 
     int quit = 0;
 
-    int clock_speed = 1000;
-    if (argc >= 3) {
-        clock_speed = atoi(argv[2]);
-    }
-    long cycle_ns = 1000000000UL / clock_speed;
+    c8->clock_speed = clock_speed;
+
+    /* scratch state the run-ahead frames are computed on; the real state is
+     * never advanced past the current frame, so rolling back is free */
+    struct Chip8State *ahead = run_ahead > 0 ? chip8state_fork(c8) : NULL;
+
+    static struct Telemetry tm;
 
 #ifdef DEBUG
     /* print_state(c8); */
     /* print_screen(c8); */
 #endif
 
-    uint32_t cycle_start = 0, prev = 0, elapsed;
+    /*
+     * The loop runs one emulated 60 Hz frame (clock_speed/60 instructions)
+     * per iteration, then sleeps until the next frame is due. Timers follow
+     * the cycle count, so fast-forward only has to skip the sleep and most
+     * of the presents.
+     */
+    const uint64_t frame_ns = 1000000000ULL / CHIP8_TIMER_HZ;
+    const uint64_t refresh_ns = 1000000000ULL / sdl_refresh_rate(&ctx);
+    uint64_t next_frame = now_ns(), last_present = 0;
+    uint64_t title_time = next_frame, title_frame = 0;
+    int dirty = 0;
+    int beeping = 0;
 
-    struct timespec time, prevtime, diff;
-    clock_gettime(CLOCK_MONOTONIC, &time);
+    /* input latency: time of the oldest unanswered key event, and whether a
+     * key-dependent opcode has run since */
+    uint64_t key_time = 0;
+    int key_seen = 0;
 
     while (!quit) {
-        cycle_start = SDL_GetTicks();
-        prevtime = time;
-        clock_gettime(CLOCK_MONOTONIC, &time);
-
-        /* Compute time difference between cycles */
-        if (time.tv_nsec - prevtime.tv_nsec < 0) {
-            diff.tv_sec = time.tv_sec - prevtime.tv_sec - 1;
-            diff.tv_nsec = time.tv_nsec - prevtime.tv_nsec + 1000000000UL;
-        } else {
-            diff.tv_sec = time.tv_sec - prevtime.tv_sec;
-            diff.tv_nsec = time.tv_nsec - prevtime.tv_nsec;
-        }
-
         while (SDL_PollEvent(&ctx.ev) != 0) {
             if (ctx.ev.type == SDL_QUIT) {
 #ifdef DEBUG
                 printf("QUITTING...\n");
 #endif
                 quit = 1;
+            } else if (ctx.ev.type == SDL_KEYDOWN && !ctx.ev.key.repeat
+                       && ctx.ev.key.keysym.scancode == SDL_SCANCODE_TAB) {
+                fast_forward = !fast_forward;
+            } else if (ctx.ev.type == SDL_KEYDOWN && !ctx.ev.key.repeat
+                       && ctx.ev.key.keysym.scancode == SDL_SCANCODE_F1) {
+                overlay = !overlay;
+            } else if ((ctx.ev.type == SDL_KEYDOWN || ctx.ev.type == SDL_KEYUP)
+                       && !ctx.ev.key.repeat && key_time == 0) {
+                /* backdate to when SDL queued the event */
+                uint64_t age = SDL_GetTicks() - ctx.ev.key.timestamp;
+                key_time = now_ns() - age * 1000000ULL;
+                key_seen = 0;
             }
         }
-        c8->keyboard = SDL_GetKeyboardState(NULL);
+        c8->keys = read_keys();
 
-        /* 60 Hz countdown */
-        if ((cycle_start - prev) >= 16 && c8->delay_timer) {
-            printf("60Hz tick\n");
-            if (c8->delay_timer) {
-                c8->delay_timer--;
-            }
-            if (c8->sound_timer) {
-                c8->sound_timer--;
+        uint64_t emu_start = now_ns();
+        uint64_t cycles = c8->cycles;
+        int ops;
+        if (fast_forward) {
+            /* edges at emulated speed would overrun the sound queue, which
+             * drains in real time; stay silent until normal speed */
+            ops = chip8state_run_frame(c8);
+            if (beeping) {
+                sdl_beep(&ctx, 0, c8->frames, 0);
+                beeping = 0;
             }
-            prev = cycle_start;
+        } else {
+            ops = run_frame_sound(c8, &ctx, &beeping);
         }
-
-        enum OpType op = fetch_and_run(c8);
-
-        if (op == OP_DRAW) {
-            draw(c8, &ctx);
-        } else if (op == OP_WAIT) {
-            /* block, waiting for input */
-        } else if (op == OP_KEYPRESS) {
+        if (ops & (1 << OP_DRAW)) {
+            dirty = 1;
         }
-
-        elapsed = SDL_GetTicks() - cycle_start;
+        uint64_t frame = c8->frames;
+        telemetry_record(&tm, METRIC_INSTR, c8->cycles - cycles);
 
 #ifdef DEBUG
         /* print_state(c8); */
         /* print_screen(c8); */
 #endif
-        long wait = cycle_ns > diff.tv_nsec ? (cycle_ns - diff.tv_nsec) / 1000 : 0;
 
+        uint64_t now = now_ns();
+        int present = 1;
+        if (fast_forward) {
+            present = render_every > 0 ? frame % render_every == 0
+                                       : now - last_present >= refresh_ns;
+        }
+        struct Chip8State *shown = NULL;
+        if (present && ahead != NULL) {
+            chip8state_copy(ahead, c8);
+            for (int i = 0; i < run_ahead; i++) {
+                ops |= chip8state_run_frame(ahead);
+            }
+            shown = ahead;
+        } else if (present) {
+            shown = c8;
+        }
+        if (ops & ((1 << OP_KEYPRESS) | (1 << OP_WAIT))) {
+            key_seen = key_time != 0;
+        }
+        now = now_ns();
+        telemetry_record(&tm, METRIC_EMU, now - emu_start);
+
+        if (shown != NULL && (dirty || overlay || (ops & (1 << OP_DRAW)))) {
+            draw(shown, &ctx, &raster);
+            if (overlay) {
+                telemetry_draw_overlay(&tm, &ctx);
+            }
+            SDL_RenderPresent(ctx.rndr);
+            dirty = 0;
+            last_present = now_ns();
+            telemetry_record(&tm, METRIC_RENDER, last_present - now);
+            if (key_seen) {
+                telemetry_record(&tm, METRIC_LATENCY, last_present - key_time);
+                key_time = 0;
+                key_seen = 0;
+            }
+            now = last_present;
+        }
+
+        if (now - title_time >= 500000000ULL) {
+            char title[64];
+            double speed = (double)(frame - title_frame) * frame_ns / (now - title_time);
+            snprintf(title, sizeof(title), "Chip8 - %.1fx%s", speed,
+                     fast_forward ? " (fast-forward)" : "");
+            SDL_SetWindowTitle(ctx.win, title);
+            title_time = now;
+            title_frame = frame;
+        }
+
+        if (fast_forward) {
+            next_frame = now;
+            continue;
+        }
+        next_frame += frame_ns;
+        if (next_frame > now) {
+            long wait = (next_frame - now) / 1000;
 #ifdef DEBUG
-        printf("wait: %ld\n", wait);
+            printf("wait: %ld\n", wait);
 #endif
-
-        usleep(wait);
+            usleep(wait);
+            now = now_ns();
+            if (now > next_frame) {
+                telemetry_record(&tm, METRIC_OVERSHOOT, now - next_frame);
+            } else {
+                telemetry_record(&tm, METRIC_OVERSHOOT, 0);
+            }
+        } else if (now - next_frame > frame_ns) {
+            /* fell more than a frame behind, don't try to catch up */
+            next_frame = now;
+        }
     }
 
+    if (telemetry_csv != NULL) {
+        telemetry_dump_csv(&tm, telemetry_csv);
+    }
+    raster_free(&raster);
     sdl_cleanup(&ctx);
+    if (ahead != NULL) {
+        chip8state_destroy(ahead);
+    }
     chip8state_destroy(c8);
 
     return 0;
@@ -0,0 +1,51 @@
+#ifndef PROTO_H
+#define PROTO_H
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * chip8d wire protocol. Every message is a 4 byte header (type, pad,
+ * 16-bit payload length) followed by the payload. Both ends are on the
+ * same host, so multi-byte fields are in host byte order.
+ */
+#define CHIP8D_SOCKET "/tmp/chip8d.sock"
+#define MSG_HEADER 4
+#define MSG_MAX_PAYLOAD 65535
+#define FRAME_ROW_SIZE 9        /* u8 row, u64 pixels */
+
+/* Highest clock speed a session may ask for. Each tick waits for every
+ * session's frame, so one fast session would slow all the others. */
+#define CHIP8D_MAX_CLOCK_SPEED 1000000
+
+enum MsgType
+{
+    /* client -> server */
+    MSG_CREATE = 0x01,          /* u32 clock speed (0 = default, at most
+                                 * CHIP8D_MAX_CLOCK_SPEED), ROM bytes */
+    MSG_ATTACH = 0x02,          /* u32 session id */
+    MSG_KEYS = 0x03,            /* u16 key mask for the attached session */
+
+    /* server -> client */
+    MSG_SESSION = 0x81,         /* u32 session id, sent on create/attach */
+    MSG_FRAME = 0x82,           /* u32 frame, then FRAME_ROW_SIZE bytes per
+                                 * row that changed since the last frame;
+                                 * sent every vblank, even with no rows */
+    MSG_ERROR = 0x83,           /* text */
+};
+
+static inline void msg_header(uint8_t *buf, uint8_t type, uint16_t len)
+{
+    buf[0] = type;
+    buf[1] = 0;
+    memcpy(buf + 2, &len, sizeof(len));
+}
+
+static inline uint16_t msg_len(const uint8_t *buf)
+{
+    uint16_t len;
+    memcpy(&len, buf + 2, sizeof(len));
+    return len;
+}
+
+#endif
@@ -0,0 +1,297 @@
+#include <string.h>
+#include <stdlib.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "chip8.h"
+#include "raster.h"
+
+/* Largest stored deflate block */
+#define DEFLATE_BLOCK 65535
+#define ADLER_MOD 65521
+#define ADLER_NMAX 5552         /* bytes before the sums can overflow 32 bits */
+
+/* CRC32 tables for slicing by 4: crc_table[k][n] is the CRC of byte n
+ * followed by k zero bytes */
+static uint32_t crc_table[4][256];
+
+static void crc_init(void)
+{
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t c = n;
+        for (int k = 0; k < 8; k++) {
+            c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+        }
+        crc_table[0][n] = c;
+    }
+    for (uint32_t n = 0; n < 256; n++) {
+        for (int k = 1; k < 4; k++) {
+            uint32_t c = crc_table[k - 1][n];
+            crc_table[k][n] = crc_table[0][c & 0xFF] ^ (c >> 8);
+        }
+    }
+}
+
+static uint32_t crc_update(uint32_t c, const uint8_t *p, size_t len)
+{
+    for (; len >= 4; p += 4, len -= 4) {
+        c ^= p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+        c = crc_table[3][c & 0xFF] ^ crc_table[2][(c >> 8) & 0xFF]
+            ^ crc_table[1][(c >> 16) & 0xFF] ^ crc_table[0][c >> 24];
+    }
+    for (; len > 0; p++, len--) {
+        c = crc_table[0][(c ^ *p) & 0xFF] ^ (c >> 8);
+    }
+    return c;
+}
+
+uint32_t raster_rgb(uint8_t r, uint8_t g, uint8_t b)
+{
+    uint8_t px[4] = {r, g, b, 255};
+    uint32_t v;
+    memcpy(&v, px, sizeof(v));
+    return v;
+}
+
+/*
+ * Set up a raster at scale. Builds the CRC tables for PNG output too, so
+ * call it before any threads that share rasters are started.
+ */
+int raster_init(struct Raster *r, int scale, uint32_t off, uint32_t on)
+{
+    memset(r, 0, sizeof(*r));
+    if (scale < 1) {
+        return 1;
+    }
+    r->scale = scale;
+    r->width = CHIP8_WIDTH * scale;
+    r->height = CHIP8_HEIGHT * scale;
+    r->palette[0] = off;
+    r->palette[1] = on;
+
+    /* both sizes are multiples of 32 bytes, as aligned_alloc requires */
+    int groups = r->width / 8;
+    r->pixels = aligned_alloc(32, (size_t)r->width * r->height * sizeof(uint32_t));
+    r->lanes = aligned_alloc(32, groups * sizeof(*r->lanes));
+    r->column = malloc(groups);
+    if (r->pixels == NULL || r->lanes == NULL || r->column == NULL) {
+        raster_free(r);
+        return 1;
+    }
+
+    for (int g = 0; g < groups; g++) {
+        r->column[g] = 8 * g / scale;
+        for (int k = 0; k < 8; k++) {
+            r->lanes[g][k] = 0x80 >> ((8 * g + k) / scale - r->column[g]);
+        }
+    }
+    for (size_t i = 0; i < (size_t)r->width * r->height; i++) {
+        r->pixels[i] = off;
+    }
+    crc_init();
+    return 0;
+}
+
+void raster_free(struct Raster *r)
+{
+    free(r->pixels);
+    free(r->lanes);
+    free(r->column);
+    r->pixels = NULL;
+    r->lanes = NULL;
+    r->column = NULL;
+}
+
+/*
+ * Expand each screen row to the first of its scale lines, 8 pixels per
+ * group: the screen byte starting at the group's column is broadcast and
+ * tested against each pixel's bit, and the result selects off or on. Every
+ * group is stored to all scale lines while it is still in a register.
+ */
+void raster_draw(struct Raster *r, const uint64_t *screen)
+{
+    int groups = r->width / 8;
+    size_t stride = r->width;
+#if defined(__AVX2__)
+    __m256i off = _mm256_set1_epi32(r->palette[0]);
+    __m256i diff = _mm256_set1_epi32(r->palette[0] ^ r->palette[1]);
+#elif defined(__SSE2__)
+    __m128i off = _mm_set1_epi32(r->palette[0]);
+    __m128i diff = _mm_set1_epi32(r->palette[0] ^ r->palette[1]);
+#endif
+
+    for (int y = 0; y < CHIP8_HEIGHT; y++) {
+        uint64_t row = screen[y];
+        uint32_t *line = r->pixels + y * r->scale * stride;
+        for (int g = 0; g < groups; g++) {
+            uint8_t byte = (row << r->column[g]) >> 56;
+            uint32_t *out = line + 8 * g;
+#if defined(__AVX2__)
+            __m256i mask = _mm256_load_si256((const __m256i *)r->lanes[g]);
+            __m256i bits = _mm256_and_si256(_mm256_set1_epi32(byte), mask);
+            __m256i lit = _mm256_cmpeq_epi32(bits, mask);
+            __m256i px = _mm256_xor_si256(off, _mm256_and_si256(lit, diff));
+            for (int s = 0; s < r->scale; s++) {
+                _mm256_storeu_si256((__m256i *)(out + s * stride), px);
+            }
+#elif defined(__SSE2__)
+            __m128i b = _mm_set1_epi32(byte);
+            __m128i mask_lo = _mm_load_si128((const __m128i *)r->lanes[g]);
+            __m128i mask_hi = _mm_load_si128((const __m128i *)(r->lanes[g] + 4));
+            __m128i lit_lo = _mm_cmpeq_epi32(_mm_and_si128(b, mask_lo), mask_lo);
+            __m128i lit_hi = _mm_cmpeq_epi32(_mm_and_si128(b, mask_hi), mask_hi);
+            __m128i px_lo = _mm_xor_si128(off, _mm_and_si128(lit_lo, diff));
+            __m128i px_hi = _mm_xor_si128(off, _mm_and_si128(lit_hi, diff));
+            for (int s = 0; s < r->scale; s++) {
+                _mm_storeu_si128((__m128i *)(out + s * stride), px_lo);
+                _mm_storeu_si128((__m128i *)(out + s * stride + 4), px_hi);
+            }
+#else
+            for (int k = 0; k < 8; k++) {
+                out[k] = r->palette[(byte & r->lanes[g][k]) != 0];
+            }
+#endif
+        }
+#if !defined(__AVX2__) && !defined(__SSE2__)
+        for (int s = 1; s < r->scale; s++) {
+            memcpy(line + s * stride, line, stride * sizeof(uint32_t));
+        }
+#endif
+    }
+}
+
+/* Binary PPM (P6); the alpha channel is dropped */
+int raster_write_ppm(const struct Raster *r, FILE *f)
+{
+    uint8_t *rgb = malloc(r->width * 3);
+    if (rgb == NULL) {
+        return 1;
+    }
+    fprintf(f, "P6\n%d %d\n255\n", r->width, r->height);
+    for (int y = 0; y < r->height; y++) {
+        const uint8_t *px = (const uint8_t *)(r->pixels + (size_t)y * r->width);
+        for (int x = 0; x < r->width; x++) {
+            memcpy(rgb + 3 * x, px + 4 * x, 3);
+        }
+        fwrite(rgb, 3, r->width, f);
+    }
+    free(rgb);
+    return ferror(f) != 0;
+}
+
+struct PngWriter
+{
+    FILE *f;
+    uint32_t crc;               /* of the current chunk */
+    uint32_t adler_a;           /* of the zlib stream */
+    uint32_t adler_b;
+    size_t raw_left;            /* uncompressed bytes not yet written */
+    size_t block_left;          /* bytes left in the current stored block */
+};
+
+static void png_put(struct PngWriter *w, const void *data, size_t len)
+{
+    w->crc = crc_update(w->crc, data, len);
+    fwrite(data, 1, len, w->f);
+}
+
+static void png_put32(struct PngWriter *w, uint32_t v)
+{
+    uint8_t be[4] = {v >> 24, v >> 16, v >> 8, v};
+    png_put(w, be, sizeof(be));
+}
+
+static void png_chunk_begin(struct PngWriter *w, const char *type, uint32_t len)
+{
+    uint8_t be[4] = {len >> 24, len >> 16, len >> 8, len};
+    fwrite(be, 1, sizeof(be), w->f);
+    w->crc = 0xFFFFFFFF;
+    png_put(w, type, 4);
+}
+
+static void png_chunk_end(struct PngWriter *w)
+{
+    uint32_t crc = w->crc ^ 0xFFFFFFFF;
+    uint8_t be[4] = {crc >> 24, crc >> 16, crc >> 8, crc};
+    fwrite(be, 1, sizeof(be), w->f);
+}
+
+/* Append raw bytes to the zlib stream as stored deflate blocks */
+static void png_deflate(struct PngWriter *w, const uint8_t *data, size_t len)
+{
+    /* adler32, taking the modulo only as often as needed */
+    uint32_t a = w->adler_a, b = w->adler_b;
+    for (size_t i = 0; i < len;) {
+        size_t n = len - i < ADLER_NMAX ? len - i : ADLER_NMAX;
+        for (size_t end = i + n; i < end; i++) {
+            a += data[i];
+            b += a;
+        }
+        a %= ADLER_MOD;
+        b %= ADLER_MOD;
+    }
+    w->adler_a = a;
+    w->adler_b = b;
+
+    while (len > 0) {
+        if (w->block_left == 0) {
+            uint16_t n = w->raw_left < DEFLATE_BLOCK ? w->raw_left : DEFLATE_BLOCK;
+            uint8_t header[5] = {w->raw_left == n, n, n >> 8, ~n, ~n >> 8};
+            png_put(w, header, sizeof(header));
+            w->block_left = n;
+        }
+        size_t n = len < w->block_left ? len : w->block_left;
+        png_put(w, data, n);
+        data += n;
+        len -= n;
+        w->block_left -= n;
+        w->raw_left -= n;
+    }
+}
+
+/*
+ * 8-bit RGBA PNG. The image data is stored uncompressed (stored deflate
+ * blocks), which keeps this fast and free of zlib at the cost of size.
+ */
+int raster_write_png(const struct Raster *r, FILE *f)
+{
+    static const uint8_t signature[8] = {137, 'P', 'N', 'G', '\r', '\n', 26, '\n'};
+    struct PngWriter w;
+    memset(&w, 0, sizeof(w));
+    w.f = f;
+    w.adler_a = 1;
+
+    size_t line = (size_t)r->width * 4;
+    size_t raw = r->height * (1 + line);
+    size_t blocks = (raw + DEFLATE_BLOCK - 1) / DEFLATE_BLOCK;
+    w.raw_left = raw;
+
+    fwrite(signature, 1, sizeof(signature), f);
+
+    png_chunk_begin(&w, "IHDR", 13);
+    png_put32(&w, r->width);
+    png_put32(&w, r->height);
+    /* bit depth 8, color type 6 (RGBA), deflate, no filter, no interlace */
+    uint8_t ihdr[5] = {8, 6, 0, 0, 0};
+    png_put(&w, ihdr, sizeof(ihdr));
+    png_chunk_end(&w);
+
+    /* zlib header (deflate, 32K window, no preset dictionary), the stored
+     * blocks, then the adler32 of the raw data */
+    png_chunk_begin(&w, "IDAT", 2 + raw + 5 * blocks + 4);
+    uint8_t zlib[2] = {0x78, 0x01};
+    png_put(&w, zlib, sizeof(zlib));
+    for (int y = 0; y < r->height; y++) {
+        uint8_t filter = 0;
+        png_deflate(&w, &filter, 1);
+        png_deflate(&w, (const uint8_t *)(r->pixels + (size_t)y * r->width), line);
+    }
+    png_put32(&w, w.adler_b << 16 | w.adler_a);
+    png_chunk_end(&w);
+
+    png_chunk_begin(&w, "IEND", 0);
+    png_chunk_end(&w);
+    return ferror(f) != 0;
+}
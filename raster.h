@@ -0,0 +1,35 @@
+#ifndef RASTER_H
+#define RASTER_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * CPU rasterizer: expands the packed 1-bit screen rows to RGBA pixels at an
+ * integer scale. Uses AVX2 or SSE2 when the compiler targets them (build
+ * with -mavx2 or -march=native for the AVX2 path), plain C otherwise.
+ */
+
+/* Pixels are 4 bytes R, G, B, A in memory order (SDL_PIXELFORMAT_RGBA32) */
+struct Raster
+{
+    int scale;
+    int width;                  /* CHIP8_WIDTH * scale */
+    int height;                 /* CHIP8_HEIGHT * scale */
+    uint32_t palette[2];        /* off, on */
+    uint32_t *pixels;           /* width * height, rows top to bottom */
+
+    /* per group of 8 output pixels in a line: the screen column of its
+     * first pixel, and the bit each pixel tests in the byte starting there */
+    uint8_t *column;
+    uint32_t (*lanes)[8];
+};
+
+uint32_t raster_rgb(uint8_t r, uint8_t g, uint8_t b);
+int raster_init(struct Raster *r, int scale, uint32_t off, uint32_t on);
+void raster_free(struct Raster *r);
+void raster_draw(struct Raster *r, const uint64_t *screen);
+int raster_write_ppm(const struct Raster *r, FILE *f);
+int raster_write_png(const struct Raster *r, FILE *f);
+
+#endif
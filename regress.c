@@ -0,0 +1,712 @@
+#include <dirent.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "chip8.h"
+
+/*
+ * chip8-regress - runs every case in the corpus on each core and compares
+ * screen, register and memory hashes at checkpoints against the golden
+ * file. A case file names a ROM, its clock speed, the number of frames to
+ * run, the checkpoint interval and the keys held from given frames on:
+ *
+ *     rom roms/PONG
+ *     clock 1000
+ *     frames 3600
+ *     every 60
+ *     keys 120 0002        # hold key 1 from frame 120
+ *
+ * The cores are single stepping, chip8state_run_frame with its fused
+ * sequences, and run_frame on a state handed over to a fork or copy at
+ * every checkpoint. When a core leaves the golden file it is replayed next
+ * to the single-stepping core to find the first cycle they differ at.
+ */
+
+#define CORPUS_DIR "regress"
+#define GOLDEN_FILE "golden"
+#define MAX_CASES 256
+#define MAX_EVENTS 256
+#define MAX_GOLDEN 65536
+#define NAME_SIZE 64
+#define TRAIL_SIZE 3            /* longest fused sequence */
+
+struct KeyEvent
+{
+    long frame;
+    uint16_t keys;
+};
+
+struct Case
+{
+    char name[NAME_SIZE];
+    char rom[256];
+    uint32_t clock_speed;
+    long frames;
+    long every;
+    struct KeyEvent events[MAX_EVENTS];
+    int nevents;
+};
+
+struct Hashes
+{
+    uint64_t cycles;
+    uint64_t screen;
+    uint64_t regs;
+    uint64_t mem;
+};
+
+struct Golden
+{
+    char name[NAME_SIZE];
+    long frame;
+    struct Hashes h;
+};
+
+enum Core
+{
+    CORE_STEP = 0,
+    CORE_FUSED,
+    CORE_FORK,
+    CORE_COUNT,
+};
+
+static const char *core_names[CORE_COUNT] = {"step", "fused", "fork"};
+
+/* A case running on one core */
+struct Runner
+{
+    const struct Case *cs;
+    enum Core core;
+    struct Chip8State *c8;
+    struct Chip8State *spare;   /* fork core: the state retired last */
+    struct Hashes spare_hashes; /* and its hashes when it was retired */
+    long handoffs;
+    long leak_frame;            /* frame the retired state changed by, or 0 */
+    int next_event;
+};
+
+struct Job
+{
+    const struct Case *cs;
+    enum Core core;
+    const struct Golden *golden;  /* this case's checkpoints */
+    int ngolden;
+    struct Hashes *got;         /* hashes at each checkpoint */
+    int ngot;
+    int done;
+    int failed;
+    char report[1024];
+};
+
+struct Farm
+{
+    struct Job *jobs;
+    int njobs;
+    atomic_int next;
+    int update;
+};
+
+static uint64_t fnv(uint64_t h, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ p[i]) * 0x100000001B3ULL;
+    }
+    return h;
+}
+
+/*
+ * Hash the state from scratch rather than trusting the incremental hashes,
+ * so a bug in those shows up here too.
+ */
+static struct Hashes state_hashes(const struct Chip8State *c8)
+{
+    const uint64_t basis = 0xCBF29CE484222325ULL;
+    struct Hashes h;
+    h.cycles = c8->cycles;
+    h.screen = fnv(basis, c8->screen, sizeof(c8->screen));
+
+    uint8_t timers[2] = {chip8state_delay_timer(c8), chip8state_sound_timer(c8)};
+    h.regs = fnv(basis, c8->reg, sizeof(c8->reg));
+    h.regs = fnv(h.regs, &c8->addr_reg, sizeof(c8->addr_reg));
+    h.regs = fnv(h.regs, &c8->pc, sizeof(c8->pc));
+    h.regs = fnv(h.regs, &c8->stack_ptr, sizeof(c8->stack_ptr));
+    h.regs = fnv(h.regs, c8->stack, sizeof(c8->stack));
+    h.regs = fnv(h.regs, timers, sizeof(timers));
+    h.regs = fnv(h.regs, &c8->rng, sizeof(c8->rng));
+
+    h.mem = basis;
+    for (int p = 0; p < CHIP8_PAGES; p++) {
+        h.mem = fnv(h.mem, c8->pages[p]->data, CHIP8_PAGE_SIZE);
+    }
+    return h;
+}
+
+/* Names of the parts of b that differ from a, e.g. "screen, memory" */
+static void describe_diff(const struct Hashes *a, const struct Hashes *b, char *out, size_t size)
+{
+    const char *parts[4];
+    int n = 0;
+    if (a->cycles != b->cycles) {
+        parts[n++] = "cycles";
+    }
+    if (a->screen != b->screen) {
+        parts[n++] = "screen";
+    }
+    if (a->regs != b->regs) {
+        parts[n++] = "registers";
+    }
+    if (a->mem != b->mem) {
+        parts[n++] = "memory";
+    }
+    out[0] = 0;
+    for (int i = 0; i < n; i++) {
+        snprintf(out + strlen(out), size - strlen(out), "%s%s", i ? ", " : "", parts[i]);
+    }
+}
+
+static int hashes_equal(const struct Hashes *a, const struct Hashes *b)
+{
+    return a->cycles == b->cycles && a->screen == b->screen
+        && a->regs == b->regs && a->mem == b->mem;
+}
+
+static int runner_init(struct Runner *r, const struct Case *cs, enum Core core)
+{
+    memset(r, 0, sizeof(*r));
+    r->cs = cs;
+    r->core = core;
+    if (chip8state_init(&r->c8, (char *)cs->rom) != 0) {
+        return 1;
+    }
+    r->c8->clock_speed = cs->clock_speed;
+    return 0;
+}
+
+static void runner_free(struct Runner *r)
+{
+    chip8state_destroy(r->c8);
+    if (r->spare != NULL) {
+        chip8state_destroy(r->spare);
+    }
+}
+
+/* Apply the key events due at the current frame */
+static void runner_keys(struct Runner *r)
+{
+    const struct Case *cs = r->cs;
+    while (r->next_event < cs->nevents && cs->events[r->next_event].frame <= (long)r->c8->frames) {
+        r->c8->keys = cs->events[r->next_event].keys;
+        r->next_event++;
+    }
+}
+
+static void runner_frame(struct Runner *r)
+{
+    struct Chip8State *c8 = r->c8;
+    runner_keys(r);
+    if (r->core == CORE_STEP) {
+        uint64_t end = (c8->frames + 1) * c8->clock_speed / CHIP8_TIMER_HZ;
+        while (c8->cycles < end) {
+            fetch_and_run(c8);
+        }
+        c8->frames++;
+    } else {
+        chip8state_run_frame(c8);
+    }
+}
+
+/*
+ * Fork core: carry on in a new state, alternating between a fresh fork and
+ * chip8state_copy into the state retired last time. The old state is kept
+ * until the next checkpoint, so pages stay shared and every write in
+ * between goes through copy-on-write; if any of them leaks into the old
+ * state, its hashes no longer match the ones taken when it was retired.
+ */
+static void runner_handoff(struct Runner *r)
+{
+    if (r->core != CORE_FORK) {
+        return;
+    }
+    if (r->spare != NULL && r->leak_frame == 0) {
+        struct Hashes h = state_hashes(r->spare);
+        if (!hashes_equal(&h, &r->spare_hashes)) {
+            r->leak_frame = r->c8->frames;
+        }
+    }
+    struct Chip8State *next;
+    if (r->handoffs % 2 == 0 || r->spare == NULL) {
+        next = chip8state_fork(r->c8);
+        if (r->spare != NULL) {
+            chip8state_destroy(r->spare);
+        }
+    } else {
+        chip8state_copy(r->spare, r->c8);
+        next = r->spare;
+    }
+    r->spare = r->c8;
+    r->spare_hashes = state_hashes(r->spare);
+    r->c8 = next;
+    r->handoffs++;
+}
+
+static int is_checkpoint(const struct Case *cs, long frame)
+{
+    return frame % cs->every == 0 || frame == cs->frames;
+}
+
+/*
+ * Find where core first leaves the single-stepping core: replay both to the
+ * first frame whose end states differ, then bisect that frame's cycles,
+ * running the candidate from a fork taken at the frame start with
+ * chip8state_run_until. Sequences are only fused where they fit before the
+ * stopping point, so this finds the first cycle a stop can see a
+ * difference at; the opcode reported is the one single stepping runs there.
+ */
+static void locate(const struct Case *cs, enum Core core, long upto, char *out, size_t size)
+{
+    struct Runner ref, cand;
+    if (runner_init(&ref, cs, CORE_STEP) != 0 || runner_init(&cand, cs, core) != 0) {
+        snprintf(out, size, "could not replay");
+        return;
+    }
+
+    out[0] = 0;
+    for (long f = 0; f < upto; f++) {
+        struct Chip8State *ref_start = chip8state_fork(ref.c8);
+        struct Chip8State *cand_start = chip8state_fork(cand.c8);
+        runner_frame(&ref);
+        runner_frame(&cand);
+        struct Hashes a = state_hashes(ref.c8), b = state_hashes(cand.c8);
+
+        if (!hashes_equal(&a, &b)) {
+            uint16_t keys = ref.c8->keys;
+            uint64_t lo = ref_start->cycles, hi = ref.c8->cycles;
+            while (hi - lo > 1) {
+                uint64_t mid = lo + (hi - lo) / 2;
+                struct Chip8State *x = chip8state_fork(ref_start);
+                struct Chip8State *y = chip8state_fork(cand_start);
+                x->keys = y->keys = keys;
+                while (x->cycles < mid) {
+                    fetch_and_run(x);
+                }
+                while (y->cycles < mid) {
+                    chip8state_run_until(y, mid);
+                }
+                a = state_hashes(x);
+                b = state_hashes(y);
+                if (hashes_equal(&a, &b)) {
+                    lo = mid;
+                } else {
+                    hi = mid;
+                }
+                chip8state_destroy(x);
+                chip8state_destroy(y);
+            }
+
+            /* step to the difference, keeping the last few opcodes since a
+             * fused sequence may have started before lo */
+            struct Chip8State *x = chip8state_fork(ref_start);
+            struct Chip8State *y = chip8state_fork(cand_start);
+            x->keys = y->keys = keys;
+            char trail[64] = "";
+            uint16_t pcs[TRAIL_SIZE], ops[TRAIL_SIZE];
+            int n = 0;
+            while (x->cycles < hi) {
+                pcs[n % TRAIL_SIZE] = x->pc;
+                ops[n % TRAIL_SIZE] = (chip8_mem_read(x, x->pc) << 8) | chip8_mem_read(x, x->pc + 1);
+                n++;
+                fetch_and_run(x);
+            }
+            for (int i = n > TRAIL_SIZE ? n - TRAIL_SIZE : 0; i < n; i++) {
+                snprintf(trail + strlen(trail), sizeof(trail) - strlen(trail), " %03x:%04x",
+                         pcs[i % TRAIL_SIZE], ops[i % TRAIL_SIZE]);
+            }
+            while (y->cycles < hi) {
+                chip8state_run_until(y, hi);
+            }
+            a = state_hashes(x);
+            b = state_hashes(y);
+            char parts[64];
+            describe_diff(&a, &b, parts, sizeof(parts));
+            snprintf(out, size, "first differs from step at cycle %llu (frame %ld): %s\n"
+                     "    last opcodes run by step (pc:opcode):%s",
+                     (unsigned long long)lo, f, parts, trail);
+            chip8state_destroy(x);
+            chip8state_destroy(y);
+        }
+        chip8state_destroy(ref_start);
+        chip8state_destroy(cand_start);
+        if (out[0]) {
+            break;
+        }
+        if (is_checkpoint(cs, cand.c8->frames)) {
+            runner_handoff(&cand);
+        }
+    }
+    if (!out[0]) {
+        snprintf(out, size, "matches step through frame %ld", upto);
+    }
+    runner_free(&ref);
+    runner_free(&cand);
+}
+
+static void run_job(struct Farm *farm, struct Job *job)
+{
+    const struct Case *cs = job->cs;
+    struct Runner r;
+    if (runner_init(&r, cs, job->core) != 0) {
+        job->failed = 1;
+        snprintf(job->report, sizeof(job->report), "could not load %s", cs->rom);
+        return;
+    }
+    job->got = malloc((cs->frames / cs->every + 1) * sizeof(struct Hashes));
+    job->ngot = 0;
+    while ((long)r.c8->frames < cs->frames) {
+        runner_frame(&r);
+        if (is_checkpoint(cs, r.c8->frames)) {
+            job->got[job->ngot++] = state_hashes(r.c8);
+            runner_handoff(&r);
+        }
+    }
+    long leak_frame = r.leak_frame;
+    runner_free(&r);
+    job->done = 1;
+    if (leak_frame != 0) {
+        job->failed = 1;
+        snprintf(job->report, sizeof(job->report),
+                 "a forked state wrote through to its parent by frame %ld", leak_frame);
+        return;
+    }
+
+    if (farm->update && job->core == CORE_STEP) {
+        return;
+    }
+    if (job->ngolden == 0 && !farm->update) {
+        job->failed = 1;
+        snprintf(job->report, sizeof(job->report), "no golden hashes, run with -u");
+        return;
+    }
+
+    /* the step core's results become the golden file under -u, so the
+     * other cores are checked against them instead */
+    const struct Hashes *want = NULL;
+    const struct Job *step = job - job->core;
+    int k;
+    for (k = 0; k < job->ngot; k++) {
+        if (farm->update) {
+            want = &step->got[k];
+        } else if (k < job->ngolden) {
+            want = &job->golden[k].h;
+        } else {
+            break;
+        }
+        if (!hashes_equal(want, &job->got[k])) {
+            break;
+        }
+    }
+    if (k == job->ngot && (farm->update || job->ngolden == job->ngot)) {
+        return;
+    }
+
+    job->failed = 1;
+    if (k == job->ngot || k == job->ngolden) {
+        snprintf(job->report, sizeof(job->report), "%d checkpoints, golden file has %d",
+                 job->ngot, job->ngolden);
+        return;
+    }
+    long frame = (k + 1) * cs->every < cs->frames ? (k + 1) * cs->every : cs->frames;
+    char parts[64];
+    describe_diff(want, &job->got[k], parts, sizeof(parts));
+    int len = snprintf(job->report, sizeof(job->report), "checkpoint at frame %ld: %s differ",
+                       frame, parts);
+    if (job->core == CORE_STEP) {
+        snprintf(job->report + len, sizeof(job->report) - len,
+                 "\n    somewhere after cycle %llu, the previous checkpoint",
+                 k > 0 ? (unsigned long long)job->got[k - 1].cycles : 0ULL);
+    } else {
+        char where[512];
+        locate(cs, job->core, frame, where, sizeof(where));
+        snprintf(job->report + len, sizeof(job->report) - len, "\n    %s", where);
+    }
+}
+
+static void *worker(void *arg)
+{
+    struct Farm *farm = arg;
+    for (;;) {
+        int i = atomic_fetch_add(&farm->next, 1);
+        if (i >= farm->njobs) {
+            return NULL;
+        }
+        if (!farm->jobs[i].done) {
+            run_job(farm, &farm->jobs[i]);
+        }
+    }
+}
+
+static int parse_case(struct Case *cs, const char *dir, const char *file)
+{
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%s", dir, file);
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        fprintf(stderr, "Could not open file: %s\n", path);
+        return 1;
+    }
+
+    memset(cs, 0, sizeof(*cs));
+    snprintf(cs->name, sizeof(cs->name), "%.*s", (int)(strlen(file) - strlen(".case")), file);
+    cs->clock_speed = CHIP8_CLOCK_SPEED;
+    cs->frames = 600;
+    cs->every = 60;
+
+    char line[512];
+    int lineno = 0, err = 0;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        lineno++;
+        char *hash = strchr(line, '#');
+        if (hash != NULL) {
+            *hash = 0;
+        }
+        char key[32], val[256];
+        long frame;
+        unsigned mask;
+        int n = sscanf(line, "%31s %255s", key, val);
+        if (n <= 0) {
+            continue;
+        }
+        if (n == 2 && strcmp(key, "rom") == 0) {
+            snprintf(cs->rom, sizeof(cs->rom), "%s", val);
+        } else if (n == 2 && strcmp(key, "clock") == 0) {
+            cs->clock_speed = chip8_parse_clock_speed(val);
+            if (cs->clock_speed == 0) {
+                fprintf(stderr, "%s:%d: bad clock\n", path, lineno);
+                err = 1;
+            }
+        } else if (n == 2 && strcmp(key, "frames") == 0) {
+            cs->frames = atol(val);
+        } else if (n == 2 && strcmp(key, "every") == 0) {
+            cs->every = atol(val);
+        } else if (strcmp(key, "keys") == 0 && cs->nevents < MAX_EVENTS
+                   && sscanf(line, "%*s %ld %x", &frame, &mask) == 2) {
+            cs->events[cs->nevents].frame = frame;
+            cs->events[cs->nevents].keys = mask;
+            cs->nevents++;
+        } else {
+            fprintf(stderr, "%s:%d: bad line\n", path, lineno);
+            err = 1;
+        }
+    }
+    fclose(f);
+    if (!err && (cs->rom[0] == 0 || cs->clock_speed == 0 || cs->frames < 1 || cs->every < 1)) {
+        fprintf(stderr, "%s: needs a rom, and a positive clock, frames and every\n", path);
+        err = 1;
+    }
+    return err;
+}
+
+static int name_cmp(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/* Load the *.case files in dir, in name order */
+static int load_corpus(const char *dir, struct Case *cases, int *ncases)
+{
+    DIR *d = opendir(dir);
+    if (d == NULL) {
+        fprintf(stderr, "Could not open corpus: %s\n", dir);
+        return 1;
+    }
+    char *names[MAX_CASES];
+    int n = 0;
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL && n < MAX_CASES) {
+        size_t len = strlen(e->d_name);
+        if (len > 5 && len - 5 < NAME_SIZE && strcmp(e->d_name + len - 5, ".case") == 0) {
+            names[n++] = strdup(e->d_name);
+        }
+    }
+    closedir(d);
+    qsort(names, n, sizeof(char *), name_cmp);
+
+    int err = 0;
+    for (int i = 0; i < n; i++) {
+        err |= parse_case(&cases[i], dir, names[i]);
+        free(names[i]);
+    }
+    *ncases = n;
+    return err;
+}
+
+static int load_golden(const char *path, struct Golden *golden, int *ngolden)
+{
+    *ngolden = 0;
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        return 0;
+    }
+    char line[512];
+    while (fgets(line, sizeof(line), f) != NULL && *ngolden < MAX_GOLDEN) {
+        struct Golden *g = &golden[*ngolden];
+        unsigned long long cycles, screen, regs, mem;
+        if (line[0] == '#') {
+            continue;
+        }
+        if (sscanf(line, "%63s %ld %llu %llx %llx %llx", g->name, &g->frame,
+                   &cycles, &screen, &regs, &mem) == 6) {
+            g->h.cycles = cycles;
+            g->h.screen = screen;
+            g->h.regs = regs;
+            g->h.mem = mem;
+            (*ngolden)++;
+        }
+    }
+    fclose(f);
+    return 0;
+}
+
+static int write_golden(const char *path, const struct Farm *farm)
+{
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+        fprintf(stderr, "Could not open file: %s\n", path);
+        return 1;
+    }
+    fprintf(f, "# case frame cycles screen registers memory\n");
+    for (int i = 0; i < farm->njobs; i++) {
+        const struct Job *job = &farm->jobs[i];
+        if (job->core != CORE_STEP) {
+            continue;
+        }
+        for (int k = 0; k < job->ngot; k++) {
+            long frame = (k + 1) * job->cs->every;
+            const struct Hashes *h = &job->got[k];
+            fprintf(f, "%s %ld %llu %016llx %016llx %016llx\n", job->cs->name,
+                    frame < job->cs->frames ? frame : job->cs->frames,
+                    (unsigned long long)h->cycles, (unsigned long long)h->screen,
+                    (unsigned long long)h->regs, (unsigned long long)h->mem);
+        }
+    }
+    return fclose(f) != 0;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-d dir] [-j threads] [-u]\n"
+            "  -d dir     corpus of *.case files and the golden file (default " CORPUS_DIR ")\n"
+            "  -j threads worker threads (default: online CPUs)\n"
+            "  -u         rewrite the golden file from the single-stepping core\n",
+            prog);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *dir = CORPUS_DIR;
+    int threads = sysconf(_SC_NPROCESSORS_ONLN);
+    struct Farm farm;
+    memset(&farm, 0, sizeof(farm));
+
+    int opt;
+    while ((opt = getopt(argc, argv, "d:j:u")) != -1) {
+        switch (opt) {
+        case 'd':
+            dir = optarg;
+            break;
+        case 'j':
+            threads = atoi(optarg);
+            break;
+        case 'u':
+            farm.update = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (threads < 1) {
+        threads = 1;
+    }
+
+    static struct Case cases[MAX_CASES];
+    int ncases;
+    if (load_corpus(dir, cases, &ncases) != 0) {
+        return 1;
+    }
+    static struct Golden golden[MAX_GOLDEN];
+    int ngolden;
+    char golden_path[1024];
+    snprintf(golden_path, sizeof(golden_path), "%s/%s", dir, GOLDEN_FILE);
+    load_golden(golden_path, golden, &ngolden);
+
+    /* jobs are grouped by case, step core first */
+    farm.njobs = ncases * CORE_COUNT;
+    farm.jobs = calloc(farm.njobs, sizeof(struct Job));
+    atomic_init(&farm.next, 0);
+    for (int c = 0; c < ncases; c++) {
+        const struct Golden *first = NULL;
+        int count = 0;
+        for (int g = 0; g < ngolden; g++) {
+            if (strcmp(golden[g].name, cases[c].name) == 0) {
+                first = first != NULL ? first : &golden[g];
+                count++;
+            }
+        }
+        for (int k = 0; k < CORE_COUNT; k++) {
+            struct Job *job = &farm.jobs[c * CORE_COUNT + k];
+            job->cs = &cases[c];
+            job->core = k;
+            job->golden = first;
+            job->ngolden = count;
+        }
+    }
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if (farm.update) {
+        /* the other cores compare against the step results */
+        for (int c = 0; c < ncases; c++) {
+            run_job(&farm, &farm.jobs[c * CORE_COUNT]);
+        }
+    }
+    pthread_t *tids = malloc(threads * sizeof(pthread_t));
+    for (int t = 0; t < threads; t++) {
+        pthread_create(&tids[t], NULL, worker, &farm);
+    }
+    for (int t = 0; t < threads; t++) {
+        pthread_join(tids[t], NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+    int failed = 0;
+    uint64_t cycles = 0;
+    for (int i = 0; i < farm.njobs; i++) {
+        struct Job *job = &farm.jobs[i];
+        if (job->ngot > 0) {
+            cycles += job->got[job->ngot - 1].cycles;
+        }
+        printf("%-24s %-6s %s\n", job->cs->name, core_names[job->core],
+               job->failed ? "FAIL" : "ok");
+        if (job->failed) {
+            printf("    %s\n", job->report);
+            failed++;
+        }
+    }
+    printf("%d runs, %d failed, %llu instructions in %.2f s\n", farm.njobs, failed,
+           (unsigned long long)cycles, secs);
+
+    if (farm.update && write_golden(golden_path, &farm) != 0) {
+        return 1;
+    }
+    for (int i = 0; i < farm.njobs; i++) {
+        free(farm.jobs[i].got);
+    }
+    free(farm.jobs);
+    free(tids);
+    return failed != 0;
+}
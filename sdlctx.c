@@ -1,6 +1,160 @@
+#include <math.h>
+#include <string.h>
 #include "sdlctx.h"
 
 
+/* Phase increment for a square wave of hz, in 1/2^32ths of a period */
+static uint32_t tone_step(double hz)
+{
+    return (uint32_t)(hz * 4294967296.0 / SOUND_FREQ);
+}
+
+static void sound_apply(struct SoundState *snd, const struct SoundCmd *cmd)
+{
+    switch (cmd->type) {
+    case SOUND_BEEP_OFF:
+        snd->on = 0;
+        break;
+    case SOUND_BEEP_ON:
+        snd->on = 1;
+        break;
+    case SOUND_PATTERN:
+        memcpy(snd->pattern, cmd->pattern, SOUND_PATTERN_SIZE);
+        snd->use_pattern = 1;
+        snd->step = cmd->step;
+        break;
+    }
+}
+
+/*
+ * Runs on SDL's audio thread. A frame's beep edges are placed on one
+ * timeline: it starts at the sample the frame's first edge is picked up at,
+ * and each edge is due its offset into the frame after that, across buffers
+ * if need be, so the edges keep the spacing they had in the frame. Pattern
+ * changes apply as soon as they are picked up. Commands never overtake
+ * each other. Never takes a lock the emulator could be holding.
+ */
+static void sound_callback(void *userdata, Uint8 *stream, int len)
+{
+    struct SoundState *snd = userdata;
+    int16_t *out = (int16_t *)stream;
+    int n = len / sizeof(int16_t);
+
+    unsigned tail = atomic_load_explicit(&snd->tail, memory_order_relaxed);
+    unsigned head = atomic_load_explicit(&snd->head, memory_order_acquire);
+    for (int i = 0; i < n; i++) {
+        for (;;) {
+            if (!snd->pending) {
+                if (tail == head) {
+                    break;
+                }
+                snd->cmd = snd->queue[tail & (SOUND_QUEUE - 1)];
+                tail++;
+                snd->pending = 1;
+                snd->due = i;
+                if (snd->cmd.type != SOUND_PATTERN) {
+                    if (!snd->timed || snd->cmd.frame != snd->frame) {
+                        snd->timed = 1;
+                        snd->frame = snd->cmd.frame;
+                        snd->base = i;
+                    }
+                    if (snd->base + snd->cmd.offset > i) {
+                        snd->due = snd->base + snd->cmd.offset;
+                    }
+                }
+            }
+            if (snd->due > i) {
+                break;
+            }
+            sound_apply(snd, &snd->cmd);
+            snd->pending = 0;
+        }
+
+        if (!snd->on) {
+            out[i] = 0;
+            continue;
+        }
+        int high;
+        if (snd->use_pattern) {
+            /* top 7 bits of the phase index the 128 pattern bits */
+            int bit = snd->phase >> 25;
+            high = (snd->pattern[bit >> 3] >> (7 - (bit & 7))) & 1;
+        } else {
+            high = snd->phase >> 31;
+        }
+        out[i] = high ? SOUND_VOLUME : -SOUND_VOLUME;
+        snd->phase += snd->step;
+    }
+    atomic_store_explicit(&snd->tail, tail, memory_order_release);
+    snd->base -= n;
+    if (snd->pending) {
+        snd->due -= n;
+    }
+}
+
+/* Queue a command for the audio callback; drops it rather than block */
+static void sound_push(struct SDLContext *ctx, const struct SoundCmd *cmd)
+{
+    struct SoundState *snd = &ctx->sound;
+    if (ctx->audio == 0) {
+        return;
+    }
+    unsigned head = atomic_load_explicit(&snd->head, memory_order_relaxed);
+    unsigned tail = atomic_load_explicit(&snd->tail, memory_order_acquire);
+    if (head - tail == SOUND_QUEUE) {
+        return;
+    }
+    snd->queue[head & (SOUND_QUEUE - 1)] = *cmd;
+    atomic_store_explicit(&snd->head, head + 1, memory_order_release);
+}
+
+static void sound_init(struct SDLContext *ctx)
+{
+    struct SoundState *snd = &ctx->sound;
+    memset(snd, 0, sizeof(*snd));
+    atomic_init(&snd->head, 0);
+    atomic_init(&snd->tail, 0);
+    snd->step = tone_step(SOUND_TONE_HZ);
+
+    SDL_AudioSpec want, have;
+    memset(&want, 0, sizeof(want));
+    want.freq = SOUND_FREQ;
+    want.format = AUDIO_S16SYS;
+    want.channels = 1;
+    want.samples = SOUND_SAMPLES;
+    want.callback = sound_callback;
+    want.userdata = snd;
+
+    ctx->audio = SDL_OpenAudioDevice(NULL, 0, &want, &have, 0);
+    if (ctx->audio == 0) {
+        SDL_Log("Could not open audio device: %s", SDL_GetError());
+        return;
+    }
+    SDL_PauseAudioDevice(ctx->audio, 0);
+}
+
+/* Start or stop the beep offset samples into emulated frame frame */
+void sdl_beep(struct SDLContext *ctx, int on, uint32_t frame, uint32_t offset)
+{
+    struct SoundCmd cmd;
+    cmd.type = on ? SOUND_BEEP_ON : SOUND_BEEP_OFF;
+    cmd.frame = frame;
+    cmd.offset = offset;
+    sound_push(ctx, &cmd);
+}
+
+/* Switch to XO-CHIP style pattern playback, 4000*2^((pitch-64)/48) bits/s */
+void sdl_sound_pattern(struct SDLContext *ctx, const uint8_t *pattern, uint8_t pitch)
+{
+    struct SoundCmd cmd;
+    cmd.type = SOUND_PATTERN;
+    memcpy(cmd.pattern, pattern, SOUND_PATTERN_SIZE);
+    cmd.step = tone_step(4000.0 * exp2((pitch - 64) / 48.0) / (8 * SOUND_PATTERN_SIZE));
+    cmd.frame = 0;
+    cmd.offset = 0;
+    sound_push(ctx, &cmd);
+}
+
 int sdl_init(struct SDLContext *ctx, int width, int height)
 {
     if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) != 0) {
@@ -18,11 +172,36 @@ int sdl_init(struct SDLContext *ctx, int width, int height)
     }
 
     ctx->rndr = SDL_CreateRenderer(ctx->win, -1, 0);
+    ctx->screen = SDL_CreateTexture(ctx->rndr, SDL_PIXELFORMAT_RGBA32,
+                                    SDL_TEXTUREACCESS_STREAMING, width, height);
+    if (ctx->screen == NULL) {
+        SDL_Log("Could not create texture: %s", SDL_GetError());
+        return 1;
+    }
+
+    /* audio is optional, a missing device only loses the beep */
+    sound_init(ctx);
     return 0;
 }
 
+/* Refresh rate of the display the window is on, 60 if unknown */
+int sdl_refresh_rate(struct SDLContext *ctx)
+{
+    SDL_DisplayMode mode;
+    int display = SDL_GetWindowDisplayIndex(ctx->win);
+    if (display < 0 || SDL_GetCurrentDisplayMode(display, &mode) != 0
+        || mode.refresh_rate <= 0) {
+        return 60;
+    }
+    return mode.refresh_rate;
+}
+
 void sdl_cleanup(struct SDLContext *ctx)
 {
+    if (ctx->audio != 0) {
+        SDL_CloseAudioDevice(ctx->audio);
+    }
+    SDL_DestroyTexture(ctx->screen);
     SDL_DestroyRenderer(ctx->rndr);
     SDL_DestroyWindow(ctx->win);
     SDL_Quit();
@@ -1,6 +1,7 @@
 #ifndef SDLCTX_H
 #define SDLCTX_H
 
+#include <stdatomic.h>
 #include <stdint.h>
 #include "SDL2/SDL.h"
 
@@ -12,14 +13,64 @@
 #define FOREGROUND_G 255
 #define FOREGROUND_B 255
 
+#define SOUND_FREQ 48000
+#define SOUND_SAMPLES 512       /* ~10.7 ms per buffer at 48 kHz */
+#define SOUND_TONE_HZ 440
+#define SOUND_VOLUME 2000
+#define SOUND_QUEUE 64          /* power of two */
+#define SOUND_PATTERN_SIZE 16   /* XO-CHIP 128 bit sample pattern */
+
+enum SoundCmdType
+{
+    SOUND_BEEP_OFF = 0,
+    SOUND_BEEP_ON,
+    SOUND_PATTERN,
+};
+
+struct SoundCmd
+{
+    uint8_t type;
+    uint8_t pattern[SOUND_PATTERN_SIZE];
+    uint32_t step;              /* phase increment per sample */
+    uint32_t frame;             /* beeps: emulated frame the edge is in */
+    uint32_t offset;            /* beeps: samples into that frame */
+};
+
+struct SoundState
+{
+    /* single producer (emulator) single consumer (audio callback) ring */
+    struct SoundCmd queue[SOUND_QUEUE];
+    atomic_uint head;           /* next slot to write, owned by producer */
+    atomic_uint tail;           /* next slot to read, owned by callback */
+
+    /* owned by the audio callback */
+    struct SoundCmd cmd;        /* picked up but not yet due */
+    int pending;
+    int64_t due;                /* sample of the current buffer cmd is due at */
+    int timed;                  /* frame and base are set */
+    uint32_t frame;             /* frame of the last beep picked up */
+    int64_t base;               /* sample of the current buffer it started at */
+    int on;
+    int use_pattern;
+    uint8_t pattern[SOUND_PATTERN_SIZE];
+    uint32_t phase;
+    uint32_t step;
+};
+
 struct SDLContext
 {
     SDL_Renderer *rndr;
     SDL_Window *win;
+    SDL_Texture *screen;        /* window sized, RGBA32, filled by draw() */
     SDL_Event ev;
+    SDL_AudioDeviceID audio;    /* 0 if no audio device could be opened */
+    struct SoundState sound;
 };
 
 int sdl_init(struct SDLContext *ctx, int width, int height);
 void sdl_cleanup(struct SDLContext *ctx);
+int sdl_refresh_rate(struct SDLContext *ctx);
+void sdl_beep(struct SDLContext *ctx, int on, uint32_t frame, uint32_t offset);
+void sdl_sound_pattern(struct SDLContext *ctx, const uint8_t *pattern, uint8_t pitch);
 
 #endif
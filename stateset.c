@@ -0,0 +1,85 @@
+#include <stdlib.h>
+#include "stateset.h"
+
+/* stand-in for the one hash value that collides with the empty marker */
+#define STATESET_ZERO 0x8000000000000000ULL
+
+struct StateSet *stateset_create(size_t capacity)
+{
+    /* keep the load factor at or below one half */
+    size_t size = 16;
+    while (size < 2 * capacity) {
+        size <<= 1;
+    }
+    struct StateSet *set = calloc(1, sizeof(struct StateSet));
+    set->slots = calloc(size, sizeof(set->slots[0]));
+    set->mask = size - 1;
+    atomic_init(&set->count, 0);
+    return set;
+}
+
+void stateset_destroy(struct StateSet *set)
+{
+    free(set->slots);
+    free(set);
+}
+
+/* Not safe to call while other threads are inserting */
+void stateset_clear(struct StateSet *set)
+{
+    for (size_t i = 0; i <= set->mask; i++) {
+        atomic_store_explicit(&set->slots[i], 0, memory_order_relaxed);
+    }
+    atomic_store(&set->count, 0);
+}
+
+/*
+ * Add hash to the set. Returns 1 if it was not there before, 0 if it was
+ * already present and -1 if the set is full.
+ */
+int stateset_insert(struct StateSet *set, uint64_t hash)
+{
+    if (hash == 0) {
+        hash = STATESET_ZERO;
+    }
+    size_t i = hash & set->mask;
+    for (size_t n = 0; n <= set->mask; n++) {
+        uint64_t cur = atomic_load_explicit(&set->slots[i], memory_order_relaxed);
+        if (cur == hash) {
+            return 0;
+        }
+        if (cur == 0) {
+            uint64_t expected = 0;
+            if (atomic_compare_exchange_strong_explicit(&set->slots[i], &expected, hash,
+                                                        memory_order_relaxed,
+                                                        memory_order_relaxed)) {
+                atomic_fetch_add_explicit(&set->count, 1, memory_order_relaxed);
+                return 1;
+            }
+            if (expected == hash) {
+                return 0;
+            }
+        }
+        i = (i + 1) & set->mask;
+    }
+    return -1;
+}
+
+int stateset_contains(struct StateSet *set, uint64_t hash)
+{
+    if (hash == 0) {
+        hash = STATESET_ZERO;
+    }
+    size_t i = hash & set->mask;
+    for (size_t n = 0; n <= set->mask; n++) {
+        uint64_t cur = atomic_load_explicit(&set->slots[i], memory_order_relaxed);
+        if (cur == hash) {
+            return 1;
+        }
+        if (cur == 0) {
+            return 0;
+        }
+        i = (i + 1) & set->mask;
+    }
+    return 0;
+}
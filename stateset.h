@@ -0,0 +1,26 @@
+#ifndef STATESET_H
+#define STATESET_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Fixed capacity, insert-only set of 64-bit state hashes. Open addressing
+ * with linear probing; inserts are lock-free and may run from any number
+ * of threads at once.
+ */
+struct StateSet
+{
+    size_t mask;                /* capacity - 1, capacity a power of two */
+    _Atomic uint64_t *slots;    /* 0 marks an empty slot */
+    atomic_size_t count;
+};
+
+struct StateSet *stateset_create(size_t capacity);
+void stateset_destroy(struct StateSet *set);
+void stateset_clear(struct StateSet *set);
+int stateset_insert(struct StateSet *set, uint64_t hash);
+int stateset_contains(struct StateSet *set, uint64_t hash);
+
+#endif
@@ -0,0 +1,161 @@
+#include <stdio.h>
+#include "chip8.h"
+#include "telemetry.h"
+
+#define OVERLAY_PIXEL 2         /* screen pixels per font pixel */
+#define OVERLAY_ALPHA 192
+
+static const char *metric_names[METRIC_COUNT] = {
+    "emu_ns",
+    "render_ns",
+    "overshoot_ns",
+    "instructions",
+    "input_latency_ns",
+};
+
+/* overlay row labels, drawn with the builtin hex font */
+static const uint8_t metric_glyphs[METRIC_COUNT] = {
+    0xE,                        /* Emulation */
+    0xD,                        /* Display */
+    0xF,                        /* Frame pacing overshoot */
+    0xC,                        /* Cycles */
+    0xA,                        /* Action latency */
+};
+
+static int bucket_index(uint64_t v)
+{
+    if (v < 2 * HIST_SUB) {
+        return v;
+    }
+    int e = 63 - __builtin_clzll(v) - HIST_SUB_BITS;
+    return (e + 1) * HIST_SUB + (int)(v >> e) - HIST_SUB;
+}
+
+static uint64_t bucket_low(int i)
+{
+    if (i < 2 * HIST_SUB) {
+        return i;
+    }
+    int e = i / HIST_SUB - 1;
+    return (uint64_t)(i % HIST_SUB + HIST_SUB) << e;
+}
+
+static uint64_t bucket_high(int i)
+{
+    if (i < 2 * HIST_SUB) {
+        return i;
+    }
+    int e = i / HIST_SUB - 1;
+    return ((uint64_t)(i % HIST_SUB + HIST_SUB + 1) << e) - 1;
+}
+
+void hist_record(struct Histogram *h, uint64_t v)
+{
+    if (h->count == 0 || v < h->min) {
+        h->min = v;
+    }
+    if (v > h->max) {
+        h->max = v;
+    }
+    h->count++;
+    h->sum += v;
+    h->buckets[bucket_index(v)]++;
+}
+
+/* Upper bound of the bucket holding the p-th fraction of samples */
+uint64_t hist_percentile(const struct Histogram *h, double p)
+{
+    if (h->count == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(p * h->count);
+    uint64_t seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen > rank) {
+            return bucket_high(i) < h->max ? bucket_high(i) : h->max;
+        }
+    }
+    return h->max;
+}
+
+void telemetry_record(struct Telemetry *t, enum Metric m, uint64_t v)
+{
+    hist_record(&t->hist[m], v);
+}
+
+int telemetry_dump_csv(const struct Telemetry *t, const char *path)
+{
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+        fprintf(stderr, "Could not open file: %s\n", path);
+        return 1;
+    }
+    fprintf(f, "metric,bucket_low,bucket_high,count\n");
+    for (int m = 0; m < METRIC_COUNT; m++) {
+        const struct Histogram *h = &t->hist[m];
+        for (int i = 0; i < HIST_BUCKETS; i++) {
+            if (h->buckets[i]) {
+                fprintf(f, "%s,%llu,%llu,%llu\n", metric_names[m],
+                        (unsigned long long)bucket_low(i),
+                        (unsigned long long)bucket_high(i),
+                        (unsigned long long)h->buckets[i]);
+            }
+        }
+    }
+    fclose(f);
+    return 0;
+}
+
+static int draw_glyph(SDL_Renderer *rndr, int x, int y, int digit)
+{
+    SDL_Rect p;
+    p.w = OVERLAY_PIXEL;
+    p.h = OVERLAY_PIXEL;
+    for (int r = 0; r < 5; r++) {
+        for (int c = 0; c < 4; c++) {
+            if ((sprite_data[digit][r] >> (7 - c)) & 1) {
+                p.x = x + c * OVERLAY_PIXEL;
+                p.y = y + r * OVERLAY_PIXEL;
+                SDL_RenderFillRect(rndr, &p);
+            }
+        }
+    }
+    return x + 5 * OVERLAY_PIXEL;
+}
+
+static int draw_number(SDL_Renderer *rndr, int x, int y, uint64_t v)
+{
+    char digits[24];
+    int n = snprintf(digits, sizeof(digits), "%llu", (unsigned long long)v);
+    for (int i = 0; i < n; i++) {
+        x = draw_glyph(rndr, x, y, digits[i] - '0');
+    }
+    return x;
+}
+
+/*
+ * One row per metric: label glyph, then p50 and p99. Times are shown in
+ * microseconds, instructions as a plain count.
+ */
+void telemetry_draw_overlay(const struct Telemetry *t, struct SDLContext *ctx)
+{
+    SDL_Renderer *rndr = ctx->rndr;
+    const int row_h = 7 * OVERLAY_PIXEL;
+
+    SDL_Rect bg = {0, 0, 18 * 5 * OVERLAY_PIXEL, METRIC_COUNT * row_h + OVERLAY_PIXEL};
+    SDL_SetRenderDrawBlendMode(rndr, SDL_BLENDMODE_BLEND);
+    SDL_SetRenderDrawColor(rndr, 0, 0, 0, OVERLAY_ALPHA);
+    SDL_RenderFillRect(rndr, &bg);
+
+    SDL_SetRenderDrawColor(rndr, 255, 255, 0, 255);
+    for (int m = 0; m < METRIC_COUNT; m++) {
+        const struct Histogram *h = &t->hist[m];
+        uint64_t div = m == METRIC_INSTR ? 1 : 1000;
+        int x = OVERLAY_PIXEL;
+        int y = OVERLAY_PIXEL + m * row_h;
+        x = draw_glyph(rndr, x, y, metric_glyphs[m]) + 5 * OVERLAY_PIXEL;
+        x = draw_number(rndr, x, y, hist_percentile(h, 0.5) / div) + 5 * OVERLAY_PIXEL;
+        draw_number(rndr, x, y, hist_percentile(h, 0.99) / div);
+    }
+}
@@ -0,0 +1,44 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdint.h>
+#include "sdlctx.h"
+
+/* log-linear buckets: values below 2*HIST_SUB are exact, above that each
+ * power of two is split into HIST_SUB buckets (~6% relative error) */
+#define HIST_SUB_BITS 4
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS (HIST_SUB * (64 - HIST_SUB_BITS + 1))
+
+struct Histogram
+{
+    uint64_t count;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+    uint64_t buckets[HIST_BUCKETS];
+};
+
+enum Metric
+{
+    METRIC_EMU = 0,             /* ns emulating a frame, run-ahead included */
+    METRIC_RENDER,              /* ns drawing and presenting */
+    METRIC_OVERSHOOT,           /* ns woken up past the frame deadline */
+    METRIC_INSTR,               /* instructions per frame */
+    METRIC_LATENCY,             /* ns from key event to the first present
+                                 * after a key-dependent opcode */
+    METRIC_COUNT,
+};
+
+struct Telemetry
+{
+    struct Histogram hist[METRIC_COUNT];
+};
+
+void hist_record(struct Histogram *h, uint64_t v);
+uint64_t hist_percentile(const struct Histogram *h, double p);
+void telemetry_record(struct Telemetry *t, enum Metric m, uint64_t v);
+int telemetry_dump_csv(const struct Telemetry *t, const char *path);
+void telemetry_draw_overlay(const struct Telemetry *t, struct SDLContext *ctx);
+
+#endif